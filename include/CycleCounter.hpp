@@ -0,0 +1,29 @@
+#pragma once
+#include <Arduino.h>
+
+// accumulates the cost of a code path in core clock cycles, cheap enough to leave enabled in production
+// note that xthal_get_ccount is core specific, so only measure spans that don't migrate between cores
+class CycleCounter
+{
+public:
+	static unsigned int now()
+	{
+		return xthal_get_ccount();
+	}
+	void add(unsigned int cycles);
+	void addSince(unsigned int startCycle);
+	void reset();
+
+	// expose properties
+	unsigned int getCount()
+	{
+		return count;
+	}
+	unsigned int getAverageNanos();
+	unsigned int getMaxNanos();
+
+private:
+	unsigned int count = 0;
+	unsigned long long totalCycles = 0;
+	unsigned int maxCycles = 0;
+};
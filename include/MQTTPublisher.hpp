@@ -0,0 +1,90 @@
+#pragma once
+#include <Arduino.h>
+
+#include <MQTT.h>
+
+#include "CycleCounter.hpp"
+
+const int MQTT_PACKET_MAX_SIZE = 1024; // the client buffer, the config and research state messages are rather large, keep enough space
+
+// sends MQTT messages from its own task so a slow network does not hold up the main loop
+// messages can coalesce, a newer one for the same topic then replaces the queued payload
+// other users of the client (loop, connect, subscribe) must hold the client lock
+class MQTTPublisher
+{
+public:
+	MQTTPublisher(MQTTClient &mqttClient);
+	bool setup();
+	bool publish(const String &topic, const String &payload, bool retained = false, int qos = 0, bool coalesce = false);
+	static int getMaxPayloadLength(const String &topic, int qos = 0);
+
+	void lockClient();
+	bool tryLockClient();
+	void unlockClient();
+
+	// expose properties
+	int getQueueDepth();
+	unsigned int getCoalescedCounter()
+	{
+		return coalescedCounter;
+	}
+	unsigned int getDroppedCounter()
+	{
+		return droppedCounter;
+	}
+	unsigned int getFailedCounter()
+	{
+		return failedCounter;
+	}
+	unsigned int getOversizeCounter()
+	{
+		return oversizeCounter;
+	}
+	bool isInFlight()
+	{
+		return inFlight;
+	}
+	CycleCounter &getLatencyCycles() // from publish() until the client returned
+	{
+		return latencyCycles;
+	}
+
+	static const int MAX_MESSAGES = 16; // bounds the memory held by queued payloads
+	static const int SENDER_TASK_STACK_DEPTH = 4096;
+
+private:
+	struct Message
+	{
+		String topic;
+		String payload;
+		bool retained = false;
+		byte qos = 0;
+		bool coalesce = false;
+		bool used = false;
+		unsigned int sequence = 0; // send order
+		unsigned int enqueuedCycle = 0;
+	};
+
+	void senderTaskHandler();
+	bool takeNext(Message &message);
+	void requeue(Message &message);
+	int findTopic(const String &topic);
+
+	MQTTClient &mqttClient;
+	Message messages[MAX_MESSAGES];
+	unsigned int nextSequence = 0;
+	volatile bool inFlight = false;
+	unsigned int coalescedCounter = 0;
+	unsigned int droppedCounter = 0;
+	unsigned int failedCounter = 0;
+	unsigned int oversizeCounter = 0; // messages that would not fit in the client buffer
+	CycleCounter latencyCycles;
+
+	SemaphoreHandle_t queueMutex = NULL;
+	StaticSemaphore_t queueMutexBuffer;
+	SemaphoreHandle_t clientMutex = NULL;
+	StaticSemaphore_t clientMutexBuffer;
+	TaskHandle_t senderTask = NULL;
+	StaticTask_t senderTaskBuffer;
+	StackType_t senderTaskStack[SENDER_TASK_STACK_DEPTH];
+};
@@ -0,0 +1,41 @@
+#pragma once
+#include <Arduino.h>
+
+#include "RinnaiProtocolDecoder.hpp"
+
+// tracks which packet bits change from one packet to the next of the same source
+// and which decoded events changed with them, to help map the bits that are not decoded yet
+class RinnaiBitActivity
+{
+public:
+	enum Track
+	{
+		HEATER_TRACK,
+		LOCAL_CONTROL_TRACK,
+		REMOTE_CONTROL_TRACK,
+	};
+	static const int TRACKS = 3;
+	static const int EVENTS = 4; // bit flags passed to update, their meaning depends on the track
+	static const int BITS = (RinnaiProtocolDecoder::BYTES_IN_PACKET - 1) * 8; // the checksum byte follows the others
+
+	void update(Track track, const byte *previous, const byte *current, byte events);
+
+	// expose properties
+	unsigned int getChangeCounter(Track track)
+	{
+		return changeCounter[track];
+	}
+	unsigned int getToggleCounter(Track track, int bit)
+	{
+		return toggleCounter[track][bit];
+	}
+	unsigned int getEventToggleCounter(Track track, int bit, int event)
+	{
+		return eventToggleCounter[track][bit][event];
+	}
+
+private:
+	unsigned int changeCounter[TRACKS] = {}; // packets that differed from the previous one
+	unsigned int toggleCounter[TRACKS][BITS] = {};
+	unsigned int eventToggleCounter[TRACKS][BITS][EVENTS] = {}; // toggles that happened in the same packet as an event
+};
@@ -0,0 +1,77 @@
+#pragma once
+#include <Arduino.h>
+
+#include <WebServer.h>
+
+#include "RinnaiSignalDecoder.hpp"
+
+// records every decoded packet to flash for long investigations, see README for the format
+// two files are used as a circular log, when the current one is full the older one is overwritten
+// records are buffered in RAM and written in batches to limit flash wear
+// repeats of the last packet of a bus are folded into a single record
+class RinnaiCaptureLog
+{
+public:
+	bool setup();
+	void loop();
+	void record(const PacketQueueItem &item, bool remote);
+	void flush();
+	void clear();
+	void download(WebServer &server);
+
+	void setEnabled(bool enabled);
+	bool isEnabled()
+	{
+		return enabled;
+	}
+	unsigned long getSize();
+
+	static const int BUFFER_BYTES = 1024;
+	static const int DOWNLOAD_CHUNK_BYTES = 1024;
+	static const unsigned long MAX_FILE_BYTES = 256 * 1024;
+
+private:
+	struct Run
+	{
+		byte data[RinnaiSignalDecoder::BYTES_IN_PACKET];
+		byte flags;
+		bool hasLast;
+		unsigned int count; // repeats of data since it was recorded
+		unsigned long lastMillis;
+	};
+
+	void writeFrame(byte flags, unsigned long millis, const byte *data);
+	void writeRun(bool remote);
+	void writeDelta(unsigned long millis);
+	void writeVarint(unsigned long value);
+	void writeByte(byte value);
+	void writeBuffer();
+	void sendDownload();
+	void stopDownload(const char *error);
+	void startFile();
+	void endSession();
+	int findCurrentFile(const long *sizes);
+	long getFileSize(int index);
+	const char *getPath(int index);
+
+	bool ready = false;
+	bool enabled = false;
+	int currentFile = 0;
+	unsigned long currentFileSize = 0; // bytes written, without the buffer
+	bool fileStarted = false;
+	unsigned long lastRecordMillis = 0;
+	unsigned long lastFlushMillis = 0;
+	Run runs[2] = {}; // tx, rx
+	byte buffer[BUFFER_BYTES];
+	int bufferSize = 0;
+	// download in progress
+	WiFiClient downloadClient;
+	bool downloading = false;
+	int downloadPart = 0; // 0 the older file, 1 the current one
+	unsigned long downloadSizes[2] = {};
+	unsigned long downloadOffset = 0; // in the file being sent
+	byte downloadChunk[DOWNLOAD_CHUNK_BYTES];
+	int chunkSize = 0;
+	int chunkSent = 0;
+	unsigned long downloadProgressMillis = 0;
+};
@@ -0,0 +1,51 @@
+#pragma once
+#include <Arduino.h>
+#include <WiFi.h>
+#include <freertos/ringbuf.h>
+
+#include "RinnaiSignalDecoder.hpp"
+
+// streams the raw edges seen by the decoders to a TCP client, for physical layer analysis with external tools
+// the stream is a header followed by 32 bit little endian words, see README for the format
+// the bit task of each decoder copies every edge it takes from its pulse queue to a ring buffer, the queue itself belongs to decoding
+// edges are sent straight out of the ring buffer without further copies, and without waiting for a slow client
+class RinnaiEdgeServer
+{
+public:
+	RinnaiEdgeServer(RinnaiSignalDecoder &rxDecoder, RinnaiSignalDecoder &txDecoder);
+	bool setup();
+	void begin(); // once wifi is connected
+	void loop();
+
+	// expose properties
+	bool isStreaming()
+	{
+		return streaming;
+	}
+	unsigned int getOverflowCounter()
+	{
+		return rxDecoder.getEdgeTapOverflowCounter() + txDecoder.getEdgeTapOverflowCounter();
+	}
+
+	static const int PORT = 2323;
+	static const int RING_BUFFER_BYTES = 8 * 1024; // ~2 seconds of edges from both buses
+
+private:
+	void startStream();
+	void stopStream();
+	void sendEdges();
+
+	RinnaiSignalDecoder &rxDecoder;
+	RinnaiSignalDecoder &txDecoder;
+	WiFiServer server;
+	WiFiClient client;
+	bool started = false;
+	bool streaming = false;
+	RingbufHandle_t ringBuffer = NULL;
+	byte *sendingData = NULL; // ring buffer item the socket has not taken all of yet
+	size_t sendingSize = 0;
+	size_t sendingSent = 0;
+	// static storage for the ring buffer
+	byte ringBufferStorage[RING_BUFFER_BYTES];
+	StaticRingbuffer_t ringBufferBuffer;
+};
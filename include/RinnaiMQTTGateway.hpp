@@ -1,10 +1,18 @@
 #pragma once
 #include <Arduino.h>
 
+#include <ArduinoJson.h>
 #include <MQTT.h>
 
 #include "RinnaiSignalDecoder.hpp"
 #include "RinnaiProtocolDecoder.hpp"
+#include "CycleCounter.hpp"
+#include "MQTTPublisher.hpp"
+#include "TokenBucket.hpp"
+#include "RinnaiPacketCensus.hpp"
+#include "RinnaiBitActivity.hpp"
+#include "RinnaiUsageAggregator.hpp"
+#include "RinnaiCaptureLog.hpp"
 
 enum DebugLevel
 {
@@ -13,6 +21,16 @@ enum DebugLevel
 	RAW,
 };
 
+// named sets of state fields, selected at runtime with the ~/telemetry topic
+enum TelemetryProfile
+{
+	TELEMETRY_MINIMAL,
+	TELEMETRY_STANDARD,
+	TELEMETRY_RESEARCH,
+	TELEMETRY_FIREHOSE,
+	TELEMETRY_PROFILE_COUNT,
+};
+
 enum OverrideCommand
 {
 	ON_OFF,
@@ -21,21 +39,81 @@ enum OverrideCommand
 	TEMPERATURE_DOWN,
 };
 
+// an override command that was handed to the proxy, tracked until its effect shows in the heater packets
+struct OverrideTransaction
+{
+	bool active;
+	OverrideCommand command;
+	byte attempts;
+	unsigned int overrideCounter; // tx decoder override counter when the packet was handed over, changes once it was sent
+	byte heaterPacketsSinceSent;
+	byte heaterPacketsWaiting; // before the packet was sent
+	bool onBefore;
+	byte temperatureCelsiusBefore;
+};
+
+// time of each startup phase in ms since boot, 0 until reached
+struct BootTiming
+{
+	unsigned long decodersReadyMillis;
+	unsigned long wifiConnectedMillis;
+	unsigned long mqttConnectedMillis;
+	unsigned long firstHeaterPacketMillis;
+	unsigned long firstStateMillis;
+};
+
+// settings that survive a reboot, stored in NVS
+// bump the version when the layout changes so an old snapshot is ignored
+struct GatewaySnapshot
+{
+	byte version;
+	int8_t targetTemperatureCelsius;
+	bool enableTemperatureSync;
+	byte logLevel;
+	byte telemetryProfile;
+};
+
 // this class will handle the logic of converting between MQTT commands and Rinnai packets
 class RinnaiMQTTGateway
 {
 public:
-	RinnaiMQTTGateway(String haDeviceName, RinnaiSignalDecoder & rxDecoder, RinnaiSignalDecoder & txDecoder, MQTTClient & mqttClient, String mqttTopic, byte testPin);
+	RinnaiMQTTGateway(String haDeviceName, RinnaiSignalDecoder & rxDecoder, RinnaiSignalDecoder & txDecoder, MQTTClient & mqttClient, MQTTPublisher & publisher, String mqttTopic, byte testPin);
 
+	void setup();
 	void loop();
 	void onMqttMessageReceived(String &topic, String &payload);
 	void onMqttConnected();
 
+	BootTiming &getBootTiming()
+	{
+		return bootTiming;
+	}
+	RinnaiCaptureLog &getCaptureLog()
+	{
+		return captureLog;
+	}
+
 private:
 	// private functions
 	bool handleIncomingPacketQueueItem(const PacketQueueItem & item, bool remote);
+	bool isRepeatedPacket(const byte *data, const byte *lastData, int counter);
 	void handleTemperatureSync();
+	void renderStateFields(DynamicJsonDocument &doc, unsigned int fields);
+	void publishCensus();
+	void publishBootTiming();
+	void saveSnapshot();
+	void publishBitActivity();
+	void publishUsage(const char *period, const RinnaiUsageAggregator::Aggregate &aggregate);
 	bool override(OverrideCommand command);
+	bool startOverride(OverrideCommand command);
+	void startQueuedOverride();
+	byte getVerifyHeaterPackets(OverrideCommand command);
+	bool sendOverride(OverrideCommand command);
+	void handleOverrideTransaction();
+	bool isOverrideEffective();
+	bool isModelPending();
+	bool getModeledOn();
+	byte getModeledTemperatureCelsius();
 	long millisDelta(unsigned long t1, unsigned long t2);
 	long millisDeltaPositive(unsigned long t1, unsigned long t2, unsigned long cycle);
 
@@ -44,20 +122,33 @@ private:
 	RinnaiSignalDecoder & rxDecoder;
 	RinnaiSignalDecoder & txDecoder;
 	MQTTClient & mqttClient;
+	MQTTPublisher & publisher;
 	String mqttTopic;
 	String mqttTopicState;
 	byte testPin;
 	DebugLevel logLevel = NONE;
+	TelemetryProfile telemetryProfile = TELEMETRY_RESEARCH; // the fields this firmware always sent
 	bool enableTemperatureSync = true; // on by default on startup, if needed this default can be made into a build option
 	int targetTemperatureCelsius = -1;
+	BootTiming bootTiming = {};
+	bool bootTimingReported = false;
+	bool snapshotRestored = false;
+	GatewaySnapshot savedSnapshot = {}; // last written, to only write on changes
+	byte emulationId = 0; // control panel id used when emulating the panel
 
 	unsigned long lastMqttReportMillis = 0;
+	TokenBucket stateRateLimiter;
+	String lastMqttReportDeferredPayload; // a change that waits for the rate limiter
+	unsigned int stateMergedCounter = 0; // changes that were never sent on their own
+	unsigned int stateTruncatedCounter = 0; // states sent with the key fields only, the rest did not fit in an MQTT packet
 	String lastMqttReportPayload;
 
 	byte lastHeaterPacketBytes[RinnaiProtocolDecoder::BYTES_IN_PACKET];
 	byte lastLocalControlPacketBytes[RinnaiProtocolDecoder::BYTES_IN_PACKET];
 	byte lastRemoteControlPacketBytes[RinnaiProtocolDecoder::BYTES_IN_PACKET];
-	byte lastUnknownPacketBytes[RinnaiProtocolDecoder::BYTES_IN_PACKET];
+	byte lastUnknownPacketBytes[RinnaiProtocolDecoder::BYTES_IN_PACKET]; // from either bus, for the report
+	byte lastLocalUnknownPacketBytes[RinnaiProtocolDecoder::BYTES_IN_PACKET]; // per bus, to match repeats
+	byte lastRemoteUnknownPacketBytes[RinnaiProtocolDecoder::BYTES_IN_PACKET];
 	RinnaiHeaterPacket lastHeaterPacketParsed;
 	RinnaiControlPacket lastLocalControlPacketParsed;
 	RinnaiControlPacket lastRemoteControlPacketParsed;
@@ -65,9 +156,35 @@ private:
 	int localControlPacketCounter = 0;
 	int remoteControlPacketCounter = 0;
 	int unknownPacketCounter = 0;
+	int localUnknownPacketCounter = 0;
+	int remoteUnknownPacketCounter = 0;
+	int repeatedPacketCounter = 0; // packets identical to the previous one from the same source
+	bool lastPacketRepeated = false;
+	RinnaiPacketCensus census; // every packet variant seen, for protocol research
+	bool censusRequested = false;
+	RinnaiBitActivity bitActivity; // which bits change with which events, for protocol research
+	unsigned long lastBitActivityReportMillis = 0;
+	RinnaiUsageAggregator usage; // heating time per minute and hour, integrated from every heater packet
+	RinnaiCaptureLog captureLog; // packet history on flash, off by default
 	unsigned long lastHeaterPacketMillis = 0;
 	unsigned long lastHeaterPacketDeltaMillis = 0;
 	unsigned long lastLocalControlPacketMillis = 0;
 	unsigned long lastRemoteControlPacketMillis = 0;
 	unsigned long lastUnknownPacketMillis = 0;
+
+	OverrideTransaction overrideTransaction = {};
+	static const int OVERRIDE_QUEUE_SIZE = 4;
+	OverrideCommand overrideQueue[OVERRIDE_QUEUE_SIZE]; // commands that came while another one was pending
+	byte overrideQueueLength = 0;
+	byte overrideQueueHeaterPackets = 0; // heater packets the first queued command waited to be sent
+	unsigned int overrideSuccessCounter = 0;
+	unsigned int overrideRetryCounter = 0;
+	unsigned int overrideFailureCounter = 0;
+	unsigned int modelRollbackCounter = 0; // predicted states that the heater did not confirm
+
+	// cost of the hot paths, reported with the raw log level
+	CycleCounter packetHandlingCycles; // packets that had to be decoded
+	CycleCounter repeatedPacketCycles; // packets that repeated the previous one
+	CycleCounter stateRenderCycles;
+	CycleCounter overrideBuildCycles;
 };
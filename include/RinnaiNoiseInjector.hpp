@@ -0,0 +1,35 @@
+#pragma once
+#include <Arduino.h>
+
+#include "RinnaiPulseClassifier.hpp"
+
+// synthetic noise applied to captured pulses before they are decoded, used to measure decoding robustness
+// the proxy output mirror in the ISR is not affected
+struct NoiseInjection
+{
+	unsigned int jitterUs;		  // max timing error added to each edge, +-us
+	unsigned int glitchPerMille;  // chance to insert a short spike after an edge
+	unsigned int dropPerMille;	  // chance to miss an edge
+	unsigned int invertPerMille;  // chance to read the wrong level for an edge
+};
+
+// applies the synthetic noise to a stream of edges
+// has no dependencies on the RTOS so the host tools sweep noise levels exactly like the firmware injects them
+class RinnaiNoiseInjector
+{
+public:
+	void configure(const NoiseInjection &noise);
+	bool isEnabled()
+	{
+		return enabled;
+	}
+	bool isMissed(); // call once per received edge, true if it should be dropped
+	void apply(PulseQueueItem &pulse); // jitter and inversion, may queue a glitch after the edge
+	bool takeInjectedPulse(PulseQueueItem &pulse); // edges of an injected glitch go before the next received edge
+
+private:
+	NoiseInjection noise = {0, 0, 0, 0};
+	bool enabled = false;
+	PulseQueueItem injectedPulses[2]; // edges of an injected glitch, waiting to be decoded
+	byte injectedPulseCount = 0;
+};
@@ -0,0 +1,95 @@
+#pragma once
+#include <Arduino.h>
+
+#include "RinnaiPulseClassifier.hpp"
+
+const int RINNAI_BYTES_IN_PACKET = 6;
+
+struct PacketQueueItem
+{
+	byte data[RINNAI_BYTES_IN_PACKET];
+	byte bitsPresent;
+	bool validPre : 1;
+	bool validChecksum : 1;
+	bool validParity : 1;
+	bool recovered : 1; // valid packet assembled after a damaged preamble or symbol
+	unsigned int startCycle; // when did it start (using core cycle counter)
+	unsigned long startMicros; // when did it start (using a counter that overflows less and has a defined origin)
+	unsigned long startMillis; // when did it start (using a counter that overflows less and has a defined origin)
+};
+
+enum PacketAssemblerEvent
+{
+	NO_EVENT,
+	PACKET_ANCHORED, // a new packet started, time stamp it
+	PACKET_READY,	 // the packet is complete, send it
+};
+
+// assembles the symbols of one bus into packets
+// a packet is anchored by a PRE symbol or, when the PRE was damaged, by any pulse after an inter-frame gap.
+// the last 48 bits since the anchor are kept in a sliding window so a packet with a damaged or extra symbol
+// can still be recovered if a window, up to MAX_RESYNC_SLIP_SYMBOLS later, passes parity and checksum.
+// has no dependencies on the RTOS so the host tools decode exactly like the firmware
+class RinnaiPacketAssembler
+{
+public:
+	RinnaiPacketAssembler();
+	PacketAssemblerEvent push(const BitQueueItem &bit);
+	PacketQueueItem &getPacket() // the packet being assembled
+	{
+		return packet;
+	}
+	static bool isValid(const PacketQueueItem &packet)
+	{
+		return packet.validParity && packet.validChecksum;
+	}
+
+	void setErrorCorrection(bool enabled)
+	{
+		errorCorrectionEnabled = enabled;
+	}
+	void clearCounters();
+
+	// expose properties
+	unsigned int getErrorCounter()
+	{
+		return errorCounter;
+	}
+	unsigned int getValidPacketCounter()
+	{
+		return validPacketCounter;
+	}
+	unsigned int getRecoveredPacketCounter()
+	{
+		return recoveredPacketCounter;
+	}
+	unsigned int getCorrectedPacketCounter()
+	{
+		return correctedPacketCounter;
+	}
+	unsigned int getUncorrectablePacketCounter()
+	{
+		return uncorrectablePacketCounter;
+	}
+
+	static const int BYTES_IN_PACKET = RINNAI_BYTES_IN_PACKET;
+	static const int BITS_IN_PACKET = BYTES_IN_PACKET * 8;
+
+private:
+	static void validatePacket(PacketQueueItem &packet);
+	static bool correctSingleBitError(PacketQueueItem &packet);
+	static bool isOddParity(byte b);
+
+	PacketQueueItem packet; // current state
+	bool anchored = false; // have we seen the start of a packet
+	bool damaged = false; // did we get error symbols since the anchor
+	unsigned int bitsSinceAnchor = 0;
+	uint64_t window = 0; // last BITS_IN_PACKET bits, oldest in bit 0
+
+	bool errorCorrectionEnabled = true;
+	unsigned int errorCounter = 0; // damaged preambles and error symbols
+	unsigned int validPacketCounter = 0;
+	unsigned int recoveredPacketCounter = 0;
+	unsigned int correctedPacketCounter = 0;
+	unsigned int uncorrectablePacketCounter = 0;
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include <Arduino.h>
+
+#include "RinnaiProtocolDecoder.hpp"
+
+// counts every distinct packet seen on each bus, to learn the full vocabulary of the protocol
+// a fixed size open addressing hash table, when full the least recently seen variant is evicted
+class RinnaiPacketCensus
+{
+public:
+	struct Entry
+	{
+		byte data[RinnaiProtocolDecoder::BYTES_IN_PACKET];
+		bool used;
+		bool remote; // seen on the heater side bus
+		unsigned int count;
+		unsigned long firstSeenMillis;
+		unsigned long lastSeenMillis;
+	};
+
+	static const int CAPACITY = 64; // slots, a power of 2
+	static const int MAX_ENTRIES = 48; // keep the table sparse so probes stay short
+
+	void record(const byte *data, bool remote, unsigned long millis);
+	void clear();
+
+	// expose properties
+	const Entry &getSlot(int slot)
+	{
+		return slots[slot];
+	}
+	int getSize()
+	{
+		return size;
+	}
+	unsigned int getEvictionCounter()
+	{
+		return evictionCounter;
+	}
+
+private:
+	static unsigned int hash(const byte *data, bool remote);
+	bool matches(const Entry &entry, const byte *data, bool remote);
+	void evictOldest();
+	void remove(int slot);
+
+	Entry slots[CAPACITY] = {};
+	int size = 0;
+	unsigned int evictionCounter = 0;
+};
@@ -43,6 +43,7 @@ public:
 	static bool decodeControlPacket(const byte * data, RinnaiControlPacket &packet);
 	static String renderPacket(const byte * data);
 
+	static void buildControlPacket(byte * data, byte myId);
 	static void setOnOffPressed(byte * data);
 	static void setPriorityPressed(byte * data);
 	static void setTemperatureUpPressed(byte * data);
@@ -0,0 +1,75 @@
+#pragma once
+#include <Arduino.h>
+
+enum BIT // enum for values of the bit queue item
+{
+	SYM0 = 0, // "0"
+	SYM1,	  // "1"
+	PRE,
+	ERROR,
+};
+
+// queue items are packed into as few bytes as possible, the queues are statically allocated in every decoder
+// an edge, the cycle counter value of when it happened with the LSB replaced by the new level (raise = 1, fall = 0)
+struct PulseQueueItem
+{
+	unsigned int value;
+};
+const unsigned int PULSE_LEVEL_MASK = 0x1;
+const unsigned int EDGE_TAP_ID_MASK = 0x2; // edges copied to an edge tap have the 2nd LSB replaced by the decoder id
+
+// a symbol, the cycle counter value of when it started with the 2 LSBs replaced by the BIT value
+// and the 3rd LSB set if the symbol came after an inter-frame gap
+struct BitQueueItem
+{
+	unsigned int value;
+};
+const unsigned int BIT_SYMBOL_MASK = 0x3;
+const unsigned int BIT_GAP_MASK = 0x4;
+
+// turns the edges of one bus into symbols
+// pairs each rise with the following fall and classifies the low period before and the high period of the pulse
+// has no dependencies on the RTOS so the host tools decode exactly like the firmware
+class RinnaiPulseClassifier
+{
+public:
+	bool push(const PulseQueueItem &pulse, BitQueueItem &bit); // true if a symbol was completed
+	static BIT classifySymbol(unsigned long pulseLengthLow, unsigned long pulseLengthHigh);
+
+	void setGlitchFilter(unsigned int minPulseUs);
+	void clearFrameSlotCounter()
+	{
+		frameSlotCounter = 0;
+	}
+
+	// expose properties
+	unsigned int getErrorCounter()
+	{
+		return errorCounter;
+	}
+	unsigned int getGlitchCounter()
+	{
+		return glitchCounter;
+	}
+	unsigned int getFrameSlotCounter()
+	{
+		return frameSlotCounter;
+	}
+
+	// symbol timing windows, in us, shared with the host side batch classifier
+	static const int SYMBOL_DURATION_US = 600;
+	static const int SYMBOL_SHORT_PERIOD_RATIO_MIN = SYMBOL_DURATION_US * 15 / 100;
+	static const int SYMBOL_SHORT_PERIOD_RATIO_MAX = SYMBOL_DURATION_US * 35 / 100;
+	static const int SYMBOL_LONG_PERIOD_RATIO_MIN = SYMBOL_DURATION_US * 65 / 100;
+	static const int SYMBOL_LONG_PERIOD_RATIO_MAX = SYMBOL_DURATION_US * 85 / 100;
+
+private:
+	unsigned int lastEndCycle = 0;
+	unsigned int risingCycle = 0;
+	bool waitingForFall = false;
+	unsigned int glitchFilterCycles = 0;
+
+	unsigned int errorCounter = 0; // edges out of order
+	unsigned int glitchCounter = 0;
+	unsigned int frameSlotCounter = 0; // frames we should have seen, counted by inter-frame gaps
+};
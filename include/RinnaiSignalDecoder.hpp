@@ -1,5 +1,12 @@
 #pragma once
 #include <Arduino.h>
+#include <freertos/ringbuf.h>
+
+#include "CycleCounter.hpp"
+#include "RinnaiNoiseInjector.hpp"
+#include "RinnaiPacketAssembler.hpp"
+#include "RinnaiPulseClassifier.hpp"
+#include "RinnaiSlotTracker.hpp"
 
 const byte INVALID_PIN = -1;
 
@@ -31,79 +38,259 @@ public:
 	}
 	unsigned int getBitTaskErrorCounter()
 	{
-		return bitTaskErrorCounter;
+		return bitTaskErrorCounter + pulseClassifier.getErrorCounter();
 	}
 	unsigned int getPacketTaskErrorCounter()
 	{
-		return packetTaskErrorCounter;
+		return packetTaskErrorCounter + packetAssembler.getErrorCounter();
+	}
+	unsigned int getFrameSlotCounter()
+	{
+		return pulseClassifier.getFrameSlotCounter();
+	}
+	unsigned int getValidPacketCounter()
+	{
+		return packetAssembler.getValidPacketCounter();
+	}
+	unsigned int getRecoveredPacketCounter()
+	{
+		return packetAssembler.getRecoveredPacketCounter();
+	}
+	unsigned int getFrameLossPerMille();
+	unsigned int getCorrectedPacketCounter()
+	{
+		return packetAssembler.getCorrectedPacketCounter();
+	}
+	unsigned int getUncorrectablePacketCounter()
+	{
+		return packetAssembler.getUncorrectablePacketCounter();
+	}
+	void setErrorCorrection(bool enabled)
+	{
+		packetAssembler.setErrorCorrection(enabled);
+	}
+	unsigned int getGlitchCounter()
+	{
+		return glitchCounter + pulseClassifier.getGlitchCounter();
+	}
+	void setGlitchFilter(unsigned int minPulseUs);
+	RinnaiSlotTracker & getSlotTracker()
+	{
+		return slotTracker;
+	}
+	static CycleCounter & getISRCycles() // cost of the shared gpio interrupt
+	{
+		return isrCycles;
+	}
+	static CycleCounter & getISREntryCycles() // from an edge to the start of the ISR, measured by runISRBenchmark
+	{
+		return isrEntryCycles;
+	}
+	static bool setupISRBenchmark(byte benchmarkPin);
+	static int runISRBenchmark(int samples);
+
+	void setNoiseInjection(const NoiseInjection & noise);
+	void setEdgeTap(RingbufHandle_t tap, byte tapId); // copy every received edge to a ring buffer, NULL to stop
+	unsigned int getEdgeTapOverflowCounter()
+	{
+		return edgeTapOverflowCounter;
 	}
 
 	bool setOverridePacket(const byte * data, int length);
+	void cancelOverridePacket();
+	bool setEmulationPacket(const byte * data, int length);
+	bool isEmulating()
+	{
+		return emulationEnabled;
+	}
+	unsigned int getEmulationPacketCounter() // number of packets sent while emulating, idle or override
+	{
+		return emulationPacketCounter;
+	}
+	unsigned int getOverrideCounter() // number of override packets that were sent
+	{
+		return overrideCounter;
+	}
 
-	static const int BYTES_IN_PACKET = 6;
+	static const int BYTES_IN_PACKET = RINNAI_BYTES_IN_PACKET;
+
+	// memory budget, all of it is allocated statically as part of the object
+	static const int BITS_IN_PACKET = RinnaiPacketAssembler::BITS_IN_PACKET;
+	static const int SYMBOLS_IN_PACKET = BITS_IN_PACKET + 1; // data bits and the "pre"
+	static const int PULSES_IN_SYMBOL = 2;
+	static const int MAX_PACKETS_IN_QUEUE = 3;
+	static const int PULSE_QUEUE_LENGTH = MAX_PACKETS_IN_QUEUE * SYMBOLS_IN_PACKET * PULSES_IN_SYMBOL;
+	static const int BIT_QUEUE_LENGTH = MAX_PACKETS_IN_QUEUE * SYMBOLS_IN_PACKET;
+	static const int PACKET_QUEUE_LENGTH = MAX_PACKETS_IN_QUEUE;
+	// stacks in bytes, minimum is configMINIMAL_STACK_SIZE. the free stack is logged with the raw log level, trim them only from what it shows after hours of traffic.
+	static const int BIT_TASK_STACK_DEPTH = 2560; // logs, and writes to the edge tap
+	static const int PACKET_TASK_STACK_DEPTH = 2048;
+	static const int OVERRIDE_TASK_STACK_DEPTH = 2048;
+	static const int QUEUES_RAM = PULSE_QUEUE_LENGTH * sizeof(PulseQueueItem) + BIT_QUEUE_LENGTH * sizeof(BitQueueItem) + PACKET_QUEUE_LENGTH * sizeof(PacketQueueItem) + 3 * sizeof(StaticQueue_t);
+	static const int TASKS_RAM = BIT_TASK_STACK_DEPTH + PACKET_TASK_STACK_DEPTH + OVERRIDE_TASK_STACK_DEPTH + 3 * sizeof(StaticTask_t);
+	static const int MAX_RAM = 11 * 1024; // fail the build if we grow beyond this
+	static const int MAX_DECODERS = 4; // buses served by the shared ISR
+
+	void logMemoryBudget();
+	void logStackUsage();
+
+protected:
+	// per decoder part of the ISR, receives the gpio input registers
+	typedef void (*ISRHandler)(RinnaiSignalDecoder * decoder, unsigned int cycle, unsigned int in, unsigned int in1, BaseType_t & xHigherPriorityTaskWoken);
+
+	bool isGlitchFromISR(byte newLevel);
+	bool checkMirrorFromISR(unsigned int cycle, byte newLevel, BaseType_t & xHigherPriorityTaskWoken);
+	void queuePulseFromISR(unsigned int cycle, byte newLevel, BaseType_t & xHigherPriorityTaskWoken);
+	void sendPulseFromISR(const PulseQueueItem & item, BaseType_t & xHigherPriorityTaskWoken);
+
+	ISRHandler isrHandler;
 
 private:
 	// private functions
-	void pulseISRHandler();
-	static void pulseISRHandler(void *);
+	static void pulseISRHandler(RinnaiSignalDecoder * decoder, unsigned int cycle, unsigned int in, unsigned int in1, BaseType_t & xHigherPriorityTaskWoken);
+	static void sharedISRHandler(void *);
+	static void perPinISRHandler(void *);
+	static void benchmarkISRHandler(void *);
+	static void recordBenchmarkEntryFromISR(unsigned int cycle);
 	void bitTaskHandler();
+	BaseType_t receivePulse(PulseQueueItem & pulse);
+	BaseType_t receiveEdge(PulseQueueItem & pulse);
+	bool takeHeldEdge(PulseQueueItem & pulse);
+	void tapEdge(const PulseQueueItem & pulse);
 	void packetTaskHandler();
 	void overrideTaskHandler();
+	void overrideSlot();
+	void emulateSlot();
 	void writeOverridePacket();
 	static void writePacket(const byte pin, const byte * data, const byte len, const bool invert = false);
-	static bool isOddParity(byte b);
 
 	// properties
 	byte pin = INVALID_PIN;
 	byte proxyOutPin = INVALID_PIN;
 	bool invertIn = false;
 	bool invertOut = false;
+	unsigned int pinMask; // pin bit in its gpio register bank
+	bool pinInBank1; // pins 32 and above
 	QueueHandle_t pulseQueue = NULL;
 	QueueHandle_t bitQueue = NULL;
 	QueueHandle_t packetQueue = NULL;
 	TaskHandle_t bitTask = NULL;
 	TaskHandle_t packetTask = NULL;
 	TaskHandle_t overrideTask = NULL;
+	// static storage for the queues and tasks
+	byte pulseQueueStorage[PULSE_QUEUE_LENGTH * sizeof(PulseQueueItem)];
+	byte bitQueueStorage[BIT_QUEUE_LENGTH * sizeof(BitQueueItem)];
+	byte packetQueueStorage[PACKET_QUEUE_LENGTH * sizeof(PacketQueueItem)];
+	StaticQueue_t pulseQueueBuffer;
+	StaticQueue_t bitQueueBuffer;
+	StaticQueue_t packetQueueBuffer;
+	StackType_t bitTaskStack[BIT_TASK_STACK_DEPTH];
+	StackType_t packetTaskStack[PACKET_TASK_STACK_DEPTH];
+	StackType_t overrideTaskStack[OVERRIDE_TASK_STACK_DEPTH];
+	StaticTask_t bitTaskBuffer;
+	StaticTask_t packetTaskBuffer;
+	StaticTask_t overrideTaskBuffer;
 	// packet override props
 	byte overridePacket[BYTES_IN_PACKET];
 	bool overridePacketSet = false;
 	unsigned int lastPulseCycle = 0;
-	bool isOverriding = false;
+	portMUX_TYPE overrideMux = portMUX_INITIALIZER_UNLOCKED; // the ISR and the override task both start overrides
+	volatile bool isOverriding = false;
+	unsigned int overrideCounter = 0;
+	RinnaiSlotTracker slotTracker; // predicts when the next packet starts
+	// panel emulation props
+	byte emulationPacket[BYTES_IN_PACKET];
+	bool emulationEnabled = false;
+	unsigned int nextEmulationSlotCycle = 0;
+	unsigned int emulationPacketCounter = 0;
 
 	unsigned int pulseHandlerErrorCounter = 0;
 	unsigned int bitTaskErrorCounter = 0;
 	unsigned int packetTaskErrorCounter = 0;
+	// decoding robustness props
+	RinnaiNoiseInjector noiseInjector;
+	// decoding state of the tasks
+	RinnaiPulseClassifier pulseClassifier;
+	RinnaiPacketAssembler packetAssembler;
+	// glitch filter props
+	byte lastLevel = 2; // last level passed on by the ISR, none yet
+	unsigned int glitchCounter = 0; // dropped by the ISR, the classifier counts the rest
+	unsigned int glitchFilterCycles = 0; // minimal pulse width, 0 if off
+	portMUX_TYPE heldEdgeMux = portMUX_INITIALIZER_UNLOCKED; // the ISR and the bit task both take the held edge
+	volatile bool heldEdgeSet = false; // the ISR holds the last edge until it knows it does not start a glitch
+	PulseQueueItem heldEdge;
+	TickType_t heldEdgeTick = 0;
+	// edge tap props
+	volatile RingbufHandle_t edgeTap = NULL;
+	byte edgeTapId = 0;
+	unsigned int edgeTapOverflowCounter = 0;
+	// shared ISR props
+	static RinnaiSignalDecoder * decoders[MAX_DECODERS];
+	static int decoderCount;
+	static intr_handle_t isrHandle;
+	static CycleCounter isrCycles;
+	// ISR benchmark props
+	static CycleCounter isrEntryCycles;
+	static unsigned int benchmarkPinMask; // 0 if there is no benchmark pin
+	static bool benchmarkLevel;
+	static volatile bool benchmarkPending; // an edge was made and the ISR did not see it yet
+	static volatile unsigned int benchmarkTriggerCycle;
 };
 
-struct PulseQueueItem
-{
-	byte newLevel; // raise = 1, fall = 0
-	unsigned int cycle; // when did it happen
-};
+static_assert(sizeof(RinnaiSignalDecoder) <= RinnaiSignalDecoder::MAX_RAM, "RinnaiSignalDecoder is over its RAM budget");
 
-enum BIT // enum for values of the bit queue item
+// a decoder with pins and polarity fixed at compile time
+// its ISR reduces to constant mask register accesses without the runtime pin and polarity checks
+// pins are int so that -1 (no proxy output) can be passed as is
+template <int PIN, int PROXY_OUT_PIN = -1, bool INVERT_IN = false, bool INVERT_OUT = false>
+class StaticRinnaiSignalDecoder : public RinnaiSignalDecoder
 {
-	SYM0 = 0, // "0"
-	SYM1,	  // "1"
-	PRE,
-	ERROR,
-};
+public:
+	StaticRinnaiSignalDecoder()
+		: RinnaiSignalDecoder(PIN, PROXY_OUT_PIN, INVERT_IN, INVERT_OUT)
+	{
+		isrHandler = &staticPulseISRHandler;
+	}
 
-struct BitQueueItem
-{
-	BIT bit; // what bit is it?
-	unsigned int startCycle; // when did it start
-	int misc; // for testing
-};
+private:
+	static const unsigned int PIN_MASK = 1 << (PIN & 31);
+	static const unsigned int PROXY_OUT_PIN_MASK = 1 << (PROXY_OUT_PIN & 31);
 
-struct PacketQueueItem
-{
-	byte data[RinnaiSignalDecoder::BYTES_IN_PACKET];
-	unsigned int startCycle; // when did it start (using core cycle counter)
-	unsigned long startMicros; // when did it start (using a counter that overflows less and has a defined origin)
-	unsigned long startMillis; // when did it start (using a counter that overflows less and has a defined origin)
-	byte bitsPresent;
-	bool validPre;
-	bool validChecksum;
-	bool validParity;
+	static void IRAM_ATTR staticPulseISRHandler(RinnaiSignalDecoder *decoder, unsigned int cycle, unsigned int in, unsigned int in1, BaseType_t &xHigherPriorityTaskWoken)
+	{
+		StaticRinnaiSignalDecoder *self = static_cast<StaticRinnaiSignalDecoder *>(decoder);
+		byte newLevel = (bool)((PIN >= 32 ? in1 : in) & PIN_MASK) ^ INVERT_IN;
+		if (self->isGlitchFromISR(newLevel))
+		{
+			return;
+		}
+		// track changes to output
+		if (PROXY_OUT_PIN >= 0 && self->checkMirrorFromISR(cycle, newLevel, xHigherPriorityTaskWoken))
+		{
+			// mirror
+			if (newLevel ^ INVERT_OUT)
+			{
+				if (PROXY_OUT_PIN >= 32)
+				{
+					GPIO.out1_w1ts.data = PROXY_OUT_PIN_MASK;
+				}
+				else
+				{
+					GPIO.out_w1ts = PROXY_OUT_PIN_MASK;
+				}
+			}
+			else
+			{
+				if (PROXY_OUT_PIN >= 32)
+				{
+					GPIO.out1_w1tc.data = PROXY_OUT_PIN_MASK;
+				}
+				else
+				{
+					GPIO.out_w1tc = PROXY_OUT_PIN_MASK;
+				}
+			}
+		}
+		self->queuePulseFromISR(cycle, newLevel, xHigherPriorityTaskWoken);
+	}
 };
@@ -0,0 +1,42 @@
+#pragma once
+#include <Arduino.h>
+
+// follows the period and phase of the packets sent by a device, to predict when its next packet will start
+// packets are sent in a fixed cycle, so a locked prediction is a much tighter gate than the time since the last edge
+// times are in clock cycles of the core running the ISR
+// update runs in the packet task while the ISR and the override task read the prediction, so period, phase and lock are published together
+class RinnaiSlotTracker
+{
+public:
+	void update(unsigned int startCycle);
+	bool isSlotStart(unsigned int cycle); // ISR safe
+	unsigned int predictNextStart(unsigned int cycle);
+	unsigned int scheduleSlot(unsigned int cycle, unsigned int plannedStart, unsigned int periodCycles);
+
+	// expose properties
+	bool isLocked()
+	{
+		return locked;
+	}
+	unsigned int getPeriodCycles()
+	{
+		return periodCycles;
+	}
+	unsigned int getPeriodMicros();
+	unsigned int getMeanErrorMicros();
+	unsigned int getHitPerMille();
+
+private:
+	void reset(unsigned int startCycle);
+	void publish(unsigned int startCycle, unsigned int period, bool isLocked);
+
+	portMUX_TYPE slotMux = portMUX_INITIALIZER_UNLOCKED; // guards the prediction below
+	volatile unsigned int lastStartCycle = 0;
+	volatile unsigned int periodCycles = 0; // 0 until we have a first estimate
+	volatile bool locked = false;
+	bool hasLastStart = false;
+	byte lockCounter = 0;
+	unsigned int meanErrorCycles = 0; // moving average of the prediction error
+	unsigned int predictionCounter = 0;
+	unsigned int hitCounter = 0;
+};
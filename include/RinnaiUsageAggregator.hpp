@@ -0,0 +1,43 @@
+#pragma once
+#include <Arduino.h>
+
+#include "RinnaiProtocolDecoder.hpp"
+
+// integrates heater packets into per minute and per hour usage figures
+// the state of each packet is held until the next one, which comes every ~200ms
+class RinnaiUsageAggregator
+{
+public:
+	struct Aggregate
+	{
+		unsigned long startMillis;
+		unsigned long coveredMillis; // time backed by heater packets
+		unsigned long onMillis;
+		unsigned long inUseMillis;
+		unsigned int ignitions; // times inUse turned on
+		unsigned long setpointMillis; // setpoint integrated over coveredMillis, for the mean
+	};
+
+	static const unsigned long MINUTE_MS = 60000;
+	static const unsigned long HOUR_MS = 3600000;
+
+	void update(const RinnaiHeaterPacket &packet, unsigned long millis);
+	bool takeMinute(Aggregate &aggregate);
+	bool takeHour(Aggregate &aggregate);
+
+private:
+	struct Period
+	{
+		Aggregate current;
+		Aggregate done;
+		bool ready;
+	};
+	void accumulate(Period &period, unsigned long deltaMillis);
+	void advance(Period &period, unsigned long length, unsigned long millis, bool covered);
+
+	Period minute = {};
+	Period hour = {};
+	RinnaiHeaterPacket last = {};
+	unsigned long lastMillis = 0;
+	bool hasLast = false;
+};
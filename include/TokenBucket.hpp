@@ -0,0 +1,29 @@
+#pragma once
+#include <Arduino.h>
+
+// allows bursts of up to "capacity" actions and then one action per interval
+class TokenBucket
+{
+public:
+	TokenBucket(unsigned int capacity, unsigned long intervalMillis);
+	void configure(unsigned int capacity, unsigned long intervalMillis);
+	bool tryTake(unsigned long nowMillis);
+
+	// expose properties
+	unsigned int getCapacity()
+	{
+		return capacity;
+	}
+	unsigned long getIntervalMillis()
+	{
+		return intervalMillis;
+	}
+
+private:
+	void refill(unsigned long nowMillis);
+
+	unsigned int capacity;
+	unsigned long intervalMillis; // 0 for no limit
+	unsigned int tokens;
+	unsigned long lastRefillMillis = 0;
+};
@@ -60,3 +60,9 @@
 #ifndef TX_OUT_RINNAI_PIN	 // the exit of the proxy, data from the local mcu with optional changes
 #define TX_OUT_RINNAI_PIN -1 // default is a read only mode without overriding commands
 #endif
+// Free pin to measure the latency of the gpio interrupt with ~/isr_benchmark, it is toggled by the device so leave it unconnected
+#ifndef ISR_BENCHMARK_PIN
+#define ISR_BENCHMARK_PIN -1 // off
+#endif
+// ISR_PER_PIN: define to use the per pin interrupt dispatch of ESP-IDF instead of the shared ISR, to compare the two with ~/isr_benchmark
+// RUNTIME_PIN_DECODERS: define to use decoders with the pins set at runtime instead of at compile time, to compare the cost of their ISR in the "perf isr" log line
@@ -0,0 +1,38 @@
+#include "CycleCounter.hpp"
+
+// IRAM so it can also be used to measure interrupt handlers
+void IRAM_ATTR CycleCounter::add(unsigned int cycles)
+{
+	count++;
+	totalCycles += cycles;
+	if (cycles > maxCycles)
+	{
+		maxCycles = cycles;
+	}
+}
+
+void IRAM_ATTR CycleCounter::addSince(unsigned int startCycle)
+{
+	add(xthal_get_ccount() - startCycle);
+}
+
+void CycleCounter::reset()
+{
+	count = 0;
+	totalCycles = 0;
+	maxCycles = 0;
+}
+
+unsigned int CycleCounter::getAverageNanos()
+{
+	if (count == 0)
+	{
+		return 0;
+	}
+	return clockCyclesToMicroseconds(totalCycles * 1000 / count);
+}
+
+unsigned int CycleCounter::getMaxNanos()
+{
+	return clockCyclesToMicroseconds((unsigned long long)maxCycles * 1000);
+}
@@ -0,0 +1,204 @@
+#include "MQTTPublisher.hpp"
+#include "LogStream.hpp"
+
+const int SENDER_TASK_PRIORITY = 1; // same as the main loop
+const int SENDER_IDLE_MS = 100; // how often to look for a connection while there are queued messages
+const int PUBLISH_FIXED_HEADER_MAX_SIZE = 5; // type and flags, then up to 4 bytes of remaining length
+const int PUBLISH_TOPIC_LENGTH_SIZE = 2;
+const int PUBLISH_PACKET_ID_SIZE = 2; // only with qos > 0
+
+MQTTPublisher::MQTTPublisher(MQTTClient &mqttClient)
+	: mqttClient(mqttClient)
+{
+}
+
+bool MQTTPublisher::setup()
+{
+	queueMutex = xSemaphoreCreateMutexStatic(&queueMutexBuffer);
+	clientMutex = xSemaphoreCreateMutexStatic(&clientMutexBuffer);
+	// pinned to the core of the main loop, so queued and sent cycle counts are comparable
+	senderTask = xTaskCreateStaticPinnedToCore([](void *o) { static_cast<MQTTPublisher *>(o)->senderTaskHandler(); },
+											   "mqtt sender task",
+											   SENDER_TASK_STACK_DEPTH,
+											   this,
+											   SENDER_TASK_PRIORITY,
+											   senderTaskStack,
+											   &senderTaskBuffer,
+											   xPortGetCoreID());
+	return queueMutex != NULL && clientMutex != NULL && senderTask != NULL;
+}
+
+// queue a message, returns false if the queue is full or the message would not fit in the client buffer
+bool MQTTPublisher::publish(const String &topic, const String &payload, bool retained, int qos, bool coalesce)
+{
+	if ((int)payload.length() > getMaxPayloadLength(topic, qos)) // the client would fail it on every attempt
+	{
+		oversizeCounter++;
+		logStream().printf("Error: MQTT message to '%s' is %d bytes, at most %d fit\n", topic.c_str(), payload.length(), getMaxPayloadLength(topic, qos));
+		return false;
+	}
+	xSemaphoreTake(queueMutex, portMAX_DELAY);
+	int slot = coalesce ? findTopic(topic) : -1;
+	if (slot != -1) // only the newest payload of a topic matters
+	{
+		coalescedCounter++;
+	}
+	else
+	{
+		for (int i = 0; i < MAX_MESSAGES && slot == -1; i++)
+		{
+			if (!messages[i].used)
+			{
+				slot = i;
+				messages[i].topic = topic;
+				messages[i].used = true;
+				messages[i].sequence = nextSequence++;
+			}
+		}
+	}
+	if (slot != -1)
+	{
+		messages[slot].payload = payload;
+		messages[slot].retained = retained;
+		messages[slot].qos = qos;
+		messages[slot].coalesce = coalesce;
+		messages[slot].enqueuedCycle = CycleCounter::now();
+	}
+	else
+	{
+		droppedCounter++;
+	}
+	xSemaphoreGive(queueMutex);
+	if (slot == -1)
+	{
+		return false;
+	}
+	xTaskNotifyGive(senderTask);
+	return true;
+}
+
+// the largest payload that fits in one publish packet of the client buffer
+int MQTTPublisher::getMaxPayloadLength(const String &topic, int qos)
+{
+	return MQTT_PACKET_MAX_SIZE - PUBLISH_FIXED_HEADER_MAX_SIZE - PUBLISH_TOPIC_LENGTH_SIZE - topic.length() - (qos > 0 ? PUBLISH_PACKET_ID_SIZE : 0);
+}
+
+void MQTTPublisher::lockClient()
+{
+	xSemaphoreTake(clientMutex, portMAX_DELAY);
+}
+
+// for callers that should rather skip a turn than wait for a send in progress
+bool MQTTPublisher::tryLockClient()
+{
+	return xSemaphoreTake(clientMutex, 0) == pdTRUE;
+}
+
+void MQTTPublisher::unlockClient()
+{
+	xSemaphoreGive(clientMutex);
+}
+
+int MQTTPublisher::getQueueDepth()
+{
+	int depth = 0;
+	for (int i = 0; i < MAX_MESSAGES; i++)
+	{
+		depth += messages[i].used;
+	}
+	return depth;
+}
+
+void MQTTPublisher::senderTaskHandler()
+{
+	logStream().println("mqtt sender task started");
+	Message message;
+	for (;;)
+	{
+		lockClient(); // connected() also reads the socket, which connect and reconfigure replace
+		if (!mqttClient.connected() || !takeNext(message))
+		{
+			unlockClient();
+			ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SENDER_IDLE_MS));
+			continue;
+		}
+		inFlight = true;
+		bool ret = mqttClient.publish(message.topic, message.payload, message.retained, message.qos);
+		inFlight = false;
+		unlockClient();
+		if (ret)
+		{
+			latencyCycles.addSince(message.enqueuedCycle);
+		}
+		else
+		{
+			failedCounter++;
+			logStream().printf("Error publishing an MQTT message to '%s'\n", message.topic.c_str());
+			if (message.qos > 0) // was not acknowledged, try again
+			{
+				requeue(message);
+			}
+		}
+	}
+}
+
+// move the oldest queued message out of the queue
+bool MQTTPublisher::takeNext(Message &message)
+{
+	xSemaphoreTake(queueMutex, portMAX_DELAY);
+	int oldest = -1;
+	for (int i = 0; i < MAX_MESSAGES; i++)
+	{
+		if (messages[i].used && (oldest == -1 || (int)(messages[i].sequence - messages[oldest].sequence) < 0))
+		{
+			oldest = i;
+		}
+	}
+	if (oldest != -1)
+	{
+		message.topic = messages[oldest].topic;
+		message.payload = messages[oldest].payload;
+		message.retained = messages[oldest].retained;
+		message.qos = messages[oldest].qos;
+		message.coalesce = messages[oldest].coalesce;
+		message.enqueuedCycle = messages[oldest].enqueuedCycle;
+		messages[oldest].used = false;
+		messages[oldest].topic = String(); // release the memory
+		messages[oldest].payload = String();
+	}
+	xSemaphoreGive(queueMutex);
+	return oldest != -1;
+}
+
+// put back a message that failed, unless a newer one for its topic was queued meanwhile
+void MQTTPublisher::requeue(Message &message)
+{
+	xSemaphoreTake(queueMutex, portMAX_DELAY);
+	if (!message.coalesce || findTopic(message.topic) == -1)
+	{
+		for (int i = 0; i < MAX_MESSAGES; i++)
+		{
+			if (!messages[i].used)
+			{
+				messages[i] = message;
+				messages[i].used = true;
+				messages[i].sequence = nextSequence++;
+				break;
+			}
+		}
+	}
+	xSemaphoreGive(queueMutex);
+}
+
+// a queued message that may be replaced, call with the queue locked
+int MQTTPublisher::findTopic(const String &topic)
+{
+	for (int i = 0; i < MAX_MESSAGES; i++)
+	{
+		if (messages[i].used && messages[i].coalesce && messages[i].topic == topic)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,24 @@
+#include "RinnaiBitActivity.hpp"
+
+// account for a packet that differs from the previous one of its source
+void RinnaiBitActivity::update(Track track, const byte *previous, const byte *current, byte events)
+{
+	changeCounter[track]++;
+	for (int i = 0; i < RinnaiProtocolDecoder::BYTES_IN_PACKET - 1; i++)
+	{
+		byte toggled = previous[i] ^ current[i];
+		while (toggled)
+		{
+			int bit = i * 8 + __builtin_ctz(toggled);
+			toggled &= toggled - 1; // clear lowest set bit
+			toggleCounter[track][bit]++;
+			for (int event = 0; event < EVENTS; event++)
+			{
+				if (events & (1 << event))
+				{
+					eventToggleCounter[track][bit][event]++;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,375 @@
+#include <LittleFS.h>
+#include <lwip/sockets.h>
+
+#include "RinnaiCaptureLog.hpp"
+#include "LogStream.hpp"
+
+const byte CAPTURE_VERSION = 1;
+const char CAPTURE_MAGIC[] = "RCAP";
+const unsigned long CAPTURE_FLUSH_INTERVAL_MS = 60000; // ms, bounds what is lost on a power cut
+const unsigned long CAPTURE_DOWNLOAD_TIMEOUT_MS = 10000; // ms, give up on a client that stopped reading
+// record flags
+const byte FLAG_REMOTE = 0x01;
+const byte FLAG_VALID_PRE = 0x02;
+const byte FLAG_VALID_PARITY = 0x04;
+const byte FLAG_VALID_CHECKSUM = 0x08;
+const byte FLAG_RECOVERED = 0x10;
+const byte FLAG_SESSION = 0x40; // a session header
+const byte FLAG_REPEAT = 0x80; // a run record, no data bytes
+
+bool RinnaiCaptureLog::setup()
+{
+	ready = LittleFS.begin(true); // format on first use
+	if (!ready)
+	{
+		logStream().println("Error mounting the capture file system");
+		return false;
+	}
+	// continue the log of the previous boot
+	long sizes[2];
+	for (int i = 0; i < 2; i++)
+	{
+		sizes[i] = getFileSize(i);
+	}
+	currentFile = findCurrentFile(sizes);
+	currentFileSize = sizes[currentFile] < 0 ? 0 : sizes[currentFile];
+	return true;
+}
+
+// the current file is the one with room left, files are rotated as soon as they are full so the other one is full or missing
+int RinnaiCaptureLog::findCurrentFile(const long *sizes)
+{
+	bool room[2];
+	for (int i = 0; i < 2; i++)
+	{
+		room[i] = sizes[i] >= 0 && (unsigned long)sizes[i] < MAX_FILE_BYTES;
+	}
+	if (room[0] && room[1]) // only if the file size was changed, the smaller one is newer
+	{
+		return sizes[1] < sizes[0];
+	}
+	if (room[0] || room[1])
+	{
+		return room[1];
+	}
+	// the current file was full when we stopped, start the missing one next to it
+	return sizes[1] < 0 && sizes[0] >= 0;
+}
+
+// -1 if the file does not exist
+long RinnaiCaptureLog::getFileSize(int index)
+{
+	File file = LittleFS.open(getPath(index), FILE_READ);
+	if (!file)
+	{
+		return -1;
+	}
+	long size = file.size();
+	file.close();
+	return size;
+}
+
+// write the batch every so often even if it is not full
+void RinnaiCaptureLog::loop()
+{
+	if (enabled && millis() - lastFlushMillis > CAPTURE_FLUSH_INTERVAL_MS)
+	{
+		flush();
+	}
+	if (downloading)
+	{
+		sendDownload();
+	}
+}
+
+void RinnaiCaptureLog::record(const PacketQueueItem &item, bool remote)
+{
+	if (!enabled)
+	{
+		return;
+	}
+	byte flags = (remote ? FLAG_REMOTE : 0) |
+				 (item.validPre ? FLAG_VALID_PRE : 0) |
+				 (item.validParity ? FLAG_VALID_PARITY : 0) |
+				 (item.validChecksum ? FLAG_VALID_CHECKSUM : 0) |
+				 (item.recovered ? FLAG_RECOVERED : 0);
+	Run &run = runs[remote];
+	if (run.hasLast && run.flags == flags && memcmp(run.data, item.data, sizeof(run.data)) == 0)
+	{
+		run.count++;
+		run.lastMillis = item.startMillis;
+		return;
+	}
+	writeRun(remote);
+	writeFrame(flags, item.startMillis, item.data);
+	memcpy(run.data, item.data, sizeof(run.data));
+	run.flags = flags;
+	run.hasLast = true;
+	if (currentFileSize >= MAX_FILE_BYTES) // rotate right away, so after a reboot only the current file has room
+	{
+		flush();
+	}
+}
+
+// close open runs, write the batch and move on to the other file if the current one is full
+void RinnaiCaptureLog::flush()
+{
+	lastFlushMillis = millis();
+	writeRun(false);
+	writeRun(true);
+	writeBuffer();
+	if (!ready || !fileStarted)
+	{
+		return;
+	}
+	if (currentFileSize >= MAX_FILE_BYTES && !downloading) // continue in the other file, dropping the oldest records. not while it is being sent.
+	{
+		endSession();
+		currentFile ^= 1;
+		LittleFS.remove(getPath(currentFile));
+		currentFileSize = 0;
+	}
+}
+
+// the next record starts a new session, with full frames since a reader cannot see the runs of the previous one
+void RinnaiCaptureLog::endSession()
+{
+	writeRun(false);
+	writeRun(true);
+	writeBuffer();
+	memset(runs, 0, sizeof(runs));
+	fileStarted = false;
+}
+
+// append the buffer to the current file
+void RinnaiCaptureLog::writeBuffer()
+{
+	if (!ready || bufferSize == 0)
+	{
+		return;
+	}
+	File file = LittleFS.open(getPath(currentFile), FILE_APPEND);
+	if (!file)
+	{
+		logStream().println("Error opening the capture file");
+		bufferSize = 0;
+		return;
+	}
+	file.write(buffer, bufferSize);
+	currentFileSize = file.size();
+	file.close();
+	bufferSize = 0;
+}
+
+void RinnaiCaptureLog::clear()
+{
+	if (downloading)
+	{
+		stopDownload("cleared");
+	}
+	bufferSize = 0;
+	memset(runs, 0, sizeof(runs));
+	LittleFS.remove(getPath(0));
+	LittleFS.remove(getPath(1));
+	currentFile = 0;
+	currentFileSize = 0;
+	fileStarted = false;
+}
+
+// start sending both files, oldest first. the data is sent by loop a chunk at a time, to keep the gateway running.
+void RinnaiCaptureLog::download(WebServer &server)
+{
+	if (downloading)
+	{
+		server.send(503, "text/plain", "A download is already running");
+		return;
+	}
+	flush();
+	// only what is in the files now, records written meanwhile are left for the next download
+	for (int i = 0; i < 2; i++)
+	{
+		long size = getFileSize(currentFile ^ (1 - i));
+		downloadSizes[i] = size < 0 ? 0 : size;
+	}
+	server.setContentLength(downloadSizes[0] + downloadSizes[1]);
+	server.send(200, "application/octet-stream", "");
+	downloadClient = server.client(); // keeps the connection open after the request is handled
+	downloading = true;
+	downloadPart = 0;
+	downloadOffset = 0;
+	chunkSize = 0;
+	chunkSent = 0;
+	downloadProgressMillis = millis();
+}
+
+// send what the socket takes without waiting, read the next chunk once the previous one is out
+void RinnaiCaptureLog::sendDownload()
+{
+	if (!downloadClient.connected())
+	{
+		stopDownload("client left");
+		return;
+	}
+	if (chunkSent == chunkSize)
+	{
+		while (downloadPart < 2 && downloadOffset == downloadSizes[downloadPart])
+		{
+			downloadPart++;
+			downloadOffset = 0;
+		}
+		if (downloadPart == 2)
+		{
+			stopDownload(NULL);
+			return;
+		}
+		File file = LittleFS.open(getPath(currentFile ^ (1 - downloadPart)), FILE_READ);
+		if (!file || !file.seek(downloadOffset))
+		{
+			stopDownload("file error");
+			return;
+		}
+		unsigned long left = downloadSizes[downloadPart] - downloadOffset;
+		chunkSize = file.read(downloadChunk, left < sizeof(downloadChunk) ? left : sizeof(downloadChunk));
+		file.close();
+		chunkSent = 0;
+		if (chunkSize <= 0)
+		{
+			stopDownload("file error");
+			return;
+		}
+		downloadOffset += chunkSize;
+	}
+	int sent = send(downloadClient.fd(), downloadChunk + chunkSent, chunkSize - chunkSent, MSG_DONTWAIT);
+	if (sent > 0)
+	{
+		chunkSent += sent;
+		downloadProgressMillis = millis();
+	}
+	else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+	{
+		stopDownload("send error");
+	}
+	else if (millis() - downloadProgressMillis > CAPTURE_DOWNLOAD_TIMEOUT_MS)
+	{
+		stopDownload("timeout");
+	}
+}
+
+// error is NULL if all was sent
+void RinnaiCaptureLog::stopDownload(const char *error)
+{
+	if (error)
+	{
+		logStream().printf("Capture download stopped, %s\n", error);
+	}
+	downloadClient.stop();
+	downloading = false;
+}
+
+void RinnaiCaptureLog::setEnabled(bool enabled)
+{
+	if (!ready)
+	{
+		return;
+	}
+	if (this->enabled && !enabled)
+	{
+		flush();
+	}
+	endSession(); // each session starts with a header
+	this->enabled = enabled;
+}
+
+unsigned long RinnaiCaptureLog::getSize()
+{
+	unsigned long size = bufferSize;
+	for (int i = 0; i < 2; i++)
+	{
+		long fileSize = getFileSize(i);
+		if (fileSize > 0)
+		{
+			size += fileSize;
+		}
+	}
+	return size;
+}
+
+// flags, time delta, 6 bytes
+void RinnaiCaptureLog::writeFrame(byte flags, unsigned long millis, const byte *data)
+{
+	if (!fileStarted)
+	{
+		startFile();
+	}
+	writeByte(flags);
+	writeDelta(millis);
+	for (int i = 0; i < RinnaiSignalDecoder::BYTES_IN_PACKET; i++)
+	{
+		writeByte(data[i]);
+	}
+}
+
+// flags, time delta of the last repeat, number of repeats
+void RinnaiCaptureLog::writeRun(bool remote)
+{
+	Run &run = runs[remote];
+	if (run.count == 0)
+	{
+		return;
+	}
+	if (!fileStarted)
+	{
+		startFile();
+	}
+	writeByte(FLAG_REPEAT | (remote ? FLAG_REMOTE : 0));
+	writeDelta(run.lastMillis);
+	writeVarint(run.count);
+	run.count = 0;
+}
+
+// signed delta from the previous record, zigzag encoded since a run can end before the record written ahead of it
+void RinnaiCaptureLog::writeDelta(unsigned long millis)
+{
+	long delta = (long)(millis - lastRecordMillis);
+	writeVarint(((unsigned long)delta << 1) ^ (unsigned long)(delta >> 31));
+	lastRecordMillis = millis;
+}
+
+// 7 bits per byte, least significant first, MSB set if more bytes follow
+void RinnaiCaptureLog::writeVarint(unsigned long value)
+{
+	while (value >= 0x80)
+	{
+		writeByte(value | 0x80);
+		value >>= 7;
+	}
+	writeByte(value);
+}
+
+void RinnaiCaptureLog::writeByte(byte value)
+{
+	if (bufferSize == BUFFER_BYTES)
+	{
+		writeBuffer();
+	}
+	buffer[bufferSize++] = value;
+}
+
+// session marker, magic, version and the time the deltas start from
+void RinnaiCaptureLog::startFile()
+{
+	fileStarted = true;
+	lastRecordMillis = millis();
+	writeByte(FLAG_SESSION);
+	for (int i = 0; i < 4; i++)
+	{
+		writeByte(CAPTURE_MAGIC[i]);
+	}
+	writeByte(CAPTURE_VERSION);
+	writeVarint(lastRecordMillis);
+}
+
+const char *RinnaiCaptureLog::getPath(int index)
+{
+	return index ? "/capture1.bin" : "/capture0.bin";
+}
@@ -0,0 +1,135 @@
+#include <lwip/sockets.h>
+
+#include "RinnaiEdgeServer.hpp"
+#include "LogStream.hpp"
+
+const char EDGE_STREAM_MAGIC[] = "REDG";
+const byte EDGE_STREAM_VERSION = 1;
+const byte RX_TAP_ID = 0;
+const byte TX_TAP_ID = 1;
+const int MAX_SEND_BYTES_PER_LOOP = 1460; // about one TCP segment, keep the main loop responsive
+
+RinnaiEdgeServer::RinnaiEdgeServer(RinnaiSignalDecoder &rxDecoder, RinnaiSignalDecoder &txDecoder)
+	: rxDecoder(rxDecoder), txDecoder(txDecoder), server(PORT)
+{
+}
+
+bool RinnaiEdgeServer::setup()
+{
+	ringBuffer = xRingbufferCreateStatic(RING_BUFFER_BYTES, RINGBUF_TYPE_BYTEBUF, ringBufferStorage, &ringBufferBuffer);
+	if (ringBuffer == NULL)
+	{
+		logStream().println("Error creating the edge ring buffer");
+		return false;
+	}
+	return true;
+}
+
+void RinnaiEdgeServer::begin()
+{
+	server.begin();
+	server.setNoDelay(true);
+	started = true;
+}
+
+void RinnaiEdgeServer::loop()
+{
+	if (!started || ringBuffer == NULL)
+	{
+		return;
+	}
+	// a new client replaces the current one
+	if (server.hasClient())
+	{
+		if (streaming)
+		{
+			stopStream();
+		}
+		client = server.available();
+		startStream();
+	}
+	if (!streaming)
+	{
+		return;
+	}
+	if (!client.connected())
+	{
+		stopStream();
+		return;
+	}
+	sendEdges();
+}
+
+void RinnaiEdgeServer::startStream()
+{
+	// drop edges left from a previous client
+	size_t size;
+	void *item;
+	while ((item = xRingbufferReceiveUpTo(ringBuffer, &size, 0, RING_BUFFER_BYTES)) != NULL)
+	{
+		vRingbufferReturnItem(ringBuffer, item);
+	}
+	// header, lets the client convert cycles to time
+	byte header[sizeof(EDGE_STREAM_MAGIC) - 1 + 1 + 4];
+	uint32_t cpuHz = ESP.getCpuFreqMHz() * 1000000;
+	memcpy(header, EDGE_STREAM_MAGIC, sizeof(EDGE_STREAM_MAGIC) - 1);
+	header[4] = EDGE_STREAM_VERSION;
+	memcpy(header + 5, &cpuHz, sizeof(cpuHz)); // little endian
+	client.setNoDelay(true);
+	client.write(header, sizeof(header));
+	rxDecoder.setEdgeTap(ringBuffer, RX_TAP_ID);
+	txDecoder.setEdgeTap(ringBuffer, TX_TAP_ID);
+	streaming = true;
+	logStream().println("Edge stream started");
+}
+
+void RinnaiEdgeServer::stopStream()
+{
+	rxDecoder.setEdgeTap(NULL, RX_TAP_ID);
+	txDecoder.setEdgeTap(NULL, TX_TAP_ID);
+	if (sendingData != NULL)
+	{
+		vRingbufferReturnItem(ringBuffer, sendingData);
+		sendingData = NULL;
+	}
+	client.stop();
+	streaming = false;
+	logStream().printf("Edge stream stopped, %u edges lost\n", getOverflowCounter());
+}
+
+// send directly from the ring buffer memory, items are returned once the socket took all of them
+// the socket is never waited on, what it does not take now is sent on the next loop while the decoders keep filling the ring buffer
+void RinnaiEdgeServer::sendEdges()
+{
+	size_t budget = MAX_SEND_BYTES_PER_LOOP;
+	while (budget > 0)
+	{
+		if (sendingData == NULL)
+		{
+			sendingData = (byte *)xRingbufferReceiveUpTo(ringBuffer, &sendingSize, 0, budget); // may stop short where the buffer wraps
+			if (sendingData == NULL)
+			{
+				return;
+			}
+			sendingSent = 0;
+		}
+		int sent = send(client.fd(), sendingData + sendingSent, sendingSize - sendingSent, MSG_DONTWAIT);
+		if (sent < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				logStream().printf("Error sending edges, %d\n", errno);
+				stopStream();
+			}
+			return;
+		}
+		sendingSent += sent;
+		budget = (size_t)sent < budget ? budget - sent : 0;
+		if (sendingSent < sendingSize) // the socket buffer is full
+		{
+			return;
+		}
+		vRingbufferReturnItem(ringBuffer, sendingData);
+		sendingData = NULL;
+	}
+}
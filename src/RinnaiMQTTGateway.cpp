@@ -1,23 +1,116 @@
 #include <WiFi.h>
 #include <ArduinoJson.h>
+#include <Preferences.h>
 
 #include "LogStream.hpp"
 #include "RinnaiMQTTGateway.hpp"
 
-const bool REPORT_RESEARCH_FIELDS = true; // send some additional data in JSON to help us understand the protocol better
-const int MQTT_REPORT_FORCED_FLUSH_INTERVAL_MS = 20000; // ms
-const int STATE_JSON_MAX_SIZE = REPORT_RESEARCH_FIELDS ? 500 : 300;
+const unsigned int STATE_RATE_BURST = 3; // state messages that can be sent back to back
+const unsigned long STATE_RATE_INTERVAL_MS = 1000; // ms, then at most one state message per interval
+// groups of state fields, see TELEMETRY_PROFILES
+const unsigned int FIELDS_DEVICE = 0x01; // ip, testPin, enableTemperatureSync
+const unsigned int FIELDS_CLIMATE = 0x02; // what the Home Assistant climate entity uses
+const unsigned int FIELDS_PACKETS = 0x04; // last packet of the heater and the local control panel
+const unsigned int FIELDS_RSSI = 0x08;
+const unsigned int FIELDS_DECODER = 0x10; // decoding robustness counters
+const unsigned int FIELDS_GATEWAY = 0x20; // override, model, publisher and capture counters, they change as a result of sending
+const unsigned int FIELDS_TIMING = 0x40; // packet timings and the other control panels
+const unsigned int FIELDS_ALL = 0x7f;
+
+struct TelemetryProfileSettings
+{
+	const char *name;
+	unsigned int fields; // rendered in the state message, the others are never computed
+	unsigned int keyFields; // a change in these sends a state message, the others are only sent along
+	unsigned long flushIntervalMs; // the state is sent at least this often
+	int stateJsonSize;
+	bool bitActivity; // track and publish ~/bit_activity
+};
+
+const TelemetryProfileSettings TELEMETRY_PROFILES[TELEMETRY_PROFILE_COUNT] = {
+	{"minimal", FIELDS_CLIMATE, FIELDS_CLIMATE, 60000, 200, false},
+	{"standard", FIELDS_DEVICE | FIELDS_CLIMATE | FIELDS_RSSI, FIELDS_DEVICE | FIELDS_CLIMATE, 20000, 300, false},
+	{"research", FIELDS_ALL, FIELDS_DEVICE | FIELDS_CLIMATE | FIELDS_PACKETS, 20000, 1024, true},
+	{"firehose", FIELDS_ALL, FIELDS_ALL & ~FIELDS_GATEWAY, 5000, 1024, true},
+};
 const int CONFIG_JSON_MAX_SIZE = 700;
+const int CENSUS_JSON_MAX_SIZE = 900;
+const int CENSUS_ENTRIES_PER_MESSAGE = 6; // keep each message within the MQTT packet size
+const int BIT_ACTIVITY_BITS_PER_MESSAGE = 12; // 5 counters per bit, keep each message within the MQTT packet size
+const int BIT_ACTIVITY_JSON_MAX_SIZE = JSON_OBJECT_SIZE(5) + JSON_OBJECT_SIZE(BIT_ACTIVITY_BITS_PER_MESSAGE) +
+									   BIT_ACTIVITY_BITS_PER_MESSAGE * (JSON_ARRAY_SIZE(RinnaiBitActivity::EVENTS + 1) + 8); // 8 for the copied "byte.bit" key
+const unsigned long BIT_ACTIVITY_REPORT_INTERVAL_MS = 600000; // ms
+const int USAGE_JSON_MAX_SIZE = 300;
+const int BOOT_JSON_MAX_SIZE = 300;
+const int ISR_BENCHMARK_MAX_SAMPLES = 2000; // each sample blocks the loop for about 0.1 ms
+const byte SNAPSHOT_VERSION = 2;
+const char SNAPSHOT_NAMESPACE[] = "rinnai";
+const char SNAPSHOT_KEY[] = "state";
 const int MAX_OVERRIDE_PERIOD_FROM_ORIGINAL_MS = 500; // ms, only send override if there was an original message lately
+const byte OVERRIDE_VERIFY_HEATER_PACKETS = 3; // heater packets to wait for the effect of a temperature press before retrying
+const byte OVERRIDE_VERIFY_ON_OFF_HEATER_PACKETS = 10; // on/off is a toggle, a retry after a late report would undo the first press
+const byte OVERRIDE_SEND_MAX_HEATER_PACKETS = 10; // heater packets to wait for an override to be sent before giving up
+const byte MAX_OVERRIDE_ATTEMPTS = 3;
 
-RinnaiMQTTGateway::RinnaiMQTTGateway(String haDeviceName, RinnaiSignalDecoder &rxDecoder, RinnaiSignalDecoder &txDecoder, MQTTClient &mqttClient, String mqttTopic, byte testPin)
-	: haDeviceName(haDeviceName), rxDecoder(rxDecoder), txDecoder(txDecoder), mqttClient(mqttClient), mqttTopic(mqttTopic), mqttTopicState(String(mqttTopic) + "/state"), testPin(testPin)
+RinnaiMQTTGateway::RinnaiMQTTGateway(String haDeviceName, RinnaiSignalDecoder &rxDecoder, RinnaiSignalDecoder &txDecoder, MQTTClient &mqttClient, MQTTPublisher &publisher, String mqttTopic, byte testPin)
+	: haDeviceName(haDeviceName), rxDecoder(rxDecoder), txDecoder(txDecoder), mqttClient(mqttClient), publisher(publisher), mqttTopic(mqttTopic), mqttTopicState(String(mqttTopic) + "/state"), testPin(testPin), stateRateLimiter(STATE_RATE_BURST, STATE_RATE_INTERVAL_MS)
 {
 	// set a will topic to signal that we are unavailable
 	String availabilityTopic = mqttTopic + "/availability";
 	mqttClient.setWill(availabilityTopic.c_str(), "offline", true, 0); // set retained will message
 }
 
+// restore the settings from before the last reboot, so we resume control without waiting for commands
+void RinnaiMQTTGateway::setup()
+{
+	captureLog.setup();
+	Preferences preferences;
+	GatewaySnapshot snapshot;
+	preferences.begin(SNAPSHOT_NAMESPACE, true); // read only
+	size_t len = preferences.getBytes(SNAPSHOT_KEY, &snapshot, sizeof(snapshot));
+	preferences.end();
+	if (len != sizeof(snapshot) || snapshot.version != SNAPSHOT_VERSION)
+	{
+		logStream().println("No saved state to restore");
+		return;
+	}
+	targetTemperatureCelsius = snapshot.targetTemperatureCelsius;
+	enableTemperatureSync = snapshot.enableTemperatureSync;
+	logLevel = (DebugLevel)snapshot.logLevel;
+	if (snapshot.telemetryProfile < TELEMETRY_PROFILE_COUNT)
+	{
+		telemetryProfile = (TelemetryProfile)snapshot.telemetryProfile;
+	}
+	savedSnapshot = snapshot;
+	snapshotRestored = true;
+	logStream().printf("Restored state: target %d, sync %d, log level %d, telemetry %s\n", targetTemperatureCelsius, enableTemperatureSync, logLevel, TELEMETRY_PROFILES[telemetryProfile].name);
+}
+
+// write the settings that were changed by a command, NVS is flash so skip writes that change nothing
+void RinnaiMQTTGateway::saveSnapshot()
+{
+	GatewaySnapshot snapshot;
+	snapshot.version = SNAPSHOT_VERSION;
+	snapshot.targetTemperatureCelsius = targetTemperatureCelsius;
+	snapshot.enableTemperatureSync = enableTemperatureSync;
+	snapshot.logLevel = logLevel;
+	snapshot.telemetryProfile = telemetryProfile;
+	if (memcmp(&snapshot, &savedSnapshot, sizeof(snapshot)) == 0)
+	{
+		return;
+	}
+	Preferences preferences;
+	preferences.begin(SNAPSHOT_NAMESPACE, false);
+	size_t len = preferences.putBytes(SNAPSHOT_KEY, &snapshot, sizeof(snapshot));
+	preferences.end();
+	if (len != sizeof(snapshot))
+	{
+		logStream().println("Error saving state");
+		return;
+	}
+	savedSnapshot = snapshot;
+}
+
 void RinnaiMQTTGateway::loop()
 {
 	// low level rinnai decoding monitoring
@@ -32,32 +125,44 @@ void RinnaiMQTTGateway::loop()
 		logStream().printf("tx pulse: waiting %d, avail %d\n", uxQueueMessagesWaiting(txDecoder.getPulseQueue()), uxQueueSpacesAvailable(txDecoder.getPulseQueue()));
 		logStream().printf("tx bit: waiting %d, avail %d\n", uxQueueMessagesWaiting(txDecoder.getBitQueue()), uxQueueSpacesAvailable(txDecoder.getBitQueue()));
 		logStream().printf("tx packet: waiting %d, avail %d\n", uxQueueMessagesWaiting(txDecoder.getPacketQueue()), uxQueueSpacesAvailable(txDecoder.getPacketQueue()));
+
+		logStream().printf("rx frames: slots %u, valid %u, loss %u/1000, recovered %u, corrected %u, uncorrectable %u, glitches %u\n", rxDecoder.getFrameSlotCounter(), rxDecoder.getValidPacketCounter(), rxDecoder.getFrameLossPerMille(), rxDecoder.getRecoveredPacketCounter(), rxDecoder.getCorrectedPacketCounter(), rxDecoder.getUncorrectablePacketCounter(), rxDecoder.getGlitchCounter());
+		logStream().printf("tx frames: slots %u, valid %u, loss %u/1000, recovered %u, corrected %u, uncorrectable %u, glitches %u\n", txDecoder.getFrameSlotCounter(), txDecoder.getValidPacketCounter(), txDecoder.getFrameLossPerMille(), txDecoder.getRecoveredPacketCounter(), txDecoder.getCorrectedPacketCounter(), txDecoder.getUncorrectablePacketCounter(), txDecoder.getGlitchCounter());
+
+		rxDecoder.logStackUsage();
+		txDecoder.logStackUsage();
+
+		logStream().printf("tx slot: locked %d, period %u us, error %u us, hits %u/1000\n", txDecoder.getSlotTracker().isLocked(), txDecoder.getSlotTracker().getPeriodMicros(), txDecoder.getSlotTracker().getMeanErrorMicros(), txDecoder.getSlotTracker().getHitPerMille());
+
+		logStream().printf("overrides: ok %u, retry %u, fail %u, pending %d, queued %d\n", overrideSuccessCounter, overrideRetryCounter, overrideFailureCounter, overrideTransaction.active, overrideQueueLength);
+
+		logStream().printf("perf packet: %u ns avg, %u ns max, %u ops\n", packetHandlingCycles.getAverageNanos(), packetHandlingCycles.getMaxNanos(), packetHandlingCycles.getCount());
+		logStream().printf("perf repeated packet: %u ns avg, %u ns max, %u ops\n", repeatedPacketCycles.getAverageNanos(), repeatedPacketCycles.getMaxNanos(), repeatedPacketCycles.getCount());
+		logStream().printf("perf state: %u ns avg, %u ns max, %u ops\n", stateRenderCycles.getAverageNanos(), stateRenderCycles.getMaxNanos(), stateRenderCycles.getCount());
+		logStream().printf("perf isr: %u ns avg, %u ns max, %u ops\n", RinnaiSignalDecoder::getISRCycles().getAverageNanos(), RinnaiSignalDecoder::getISRCycles().getMaxNanos(), RinnaiSignalDecoder::getISRCycles().getCount());
+		logStream().printf("perf isr entry: %u ns avg, %u ns max, %u ops\n", RinnaiSignalDecoder::getISREntryCycles().getAverageNanos(), RinnaiSignalDecoder::getISREntryCycles().getMaxNanos(), RinnaiSignalDecoder::getISREntryCycles().getCount());
+		logStream().printf("perf override: %u ns avg, %u ns max, %u ops\n", overrideBuildCycles.getAverageNanos(), overrideBuildCycles.getMaxNanos(), overrideBuildCycles.getCount());
+		logStream().printf("perf publish: %u ns avg, %u ns max, %u ops, queue %d, coalesced %u, dropped %u, failed %u, oversize %u\n", publisher.getLatencyCycles().getAverageNanos(), publisher.getLatencyCycles().getMaxNanos(), publisher.getLatencyCycles().getCount(), publisher.getQueueDepth(), publisher.getCoalescedCounter(), publisher.getDroppedCounter(), publisher.getFailedCounter(), publisher.getOversizeCounter());
 	}
 	// dump intermediate item queues for low level debug
 	// might require to stop their organic consuming task in the signal decoder first
+	// raw edges are better captured with RinnaiEdgeServer, which does not disturb decoding
 	/*
-	static unsigned long lastPulseTime = 0;
-	while (uxQueueMessagesWaiting(rxDecoder.getPulseQueue()))
-	{
-		PulseQueueItem item;
-		BaseType_t ret = xQueueReceive(rxDecoder.getPulseQueue(), &item, 0); // pdTRUE=1 if an item was successfully received from the queue, otherwise pdFALSE.
-		// hack delta
-		unsigned long d = clockCyclesToMicroseconds(item.cycle - lastPulseTime);
-		lastPulseTime = item.cycle;
-		logStream().printf("rx p %d %d, q %d, r %d\n", item.newLevel, d, uxQueueMessagesWaiting(rxDecoder.getPulseQueue()), ret);
-	}
 	while (uxQueueMessagesWaiting(rxDecoder.getBitQueue()))
 	{
 		BitQueueItem item;
 		BaseType_t ret = xQueueReceive(rxDecoder.getBitQueue(), &item, 0); // pdTRUE if an item was successfully received from the queue, otherwise pdFALSE.
-		logStream().printf("rx b %d %d %d, q %d, r %d\n", item.bit, item.startCycle, item.misc, uxQueueMessagesWaiting(rxDecoder.getBitQueue()), ret);
+		logStream().printf("rx b %d %u, q %d, r %d\n", item.value & BIT_SYMBOL_MASK, item.value & ~BIT_SYMBOL_MASK, uxQueueMessagesWaiting(rxDecoder.getBitQueue()), ret);
 	}
 	*/
 	while (uxQueueMessagesWaiting(rxDecoder.getPacketQueue()))
 	{
 		PacketQueueItem item;
 		BaseType_t ret = xQueueReceive(rxDecoder.getPacketQueue(), &item, 0); // pdTRUE if an item was successfully received from the queue, otherwise pdFALSE.
-		if (handleIncomingPacketQueueItem(item, true) == false)
+		unsigned int startCycle = CycleCounter::now();
+		bool handled = handleIncomingPacketQueueItem(item, true);
+		(lastPacketRepeated ? repeatedPacketCycles : packetHandlingCycles).addSince(startCycle);
+		if (handled == false)
 		{
 			logStream().printf("Error in rx pkt %d %02x%02x%02x %u %d %d %d, q %d, r %d\n", item.bitsPresent, item.data[0], item.data[1], item.data[2], item.startCycle, item.validPre, item.validParity, item.validChecksum, uxQueueMessagesWaiting(rxDecoder.getPacketQueue()), ret);
 		}
@@ -67,107 +172,267 @@ void RinnaiMQTTGateway::loop()
 	{
 		PacketQueueItem item;
 		BaseType_t ret = xQueueReceive(txDecoder.getPacketQueue(), &item, 0); // pdTRUE if an item was successfully received from the queue, otherwise pdFALSE.
-		if (handleIncomingPacketQueueItem(item, false) == false)
+		unsigned int startCycle = CycleCounter::now();
+		bool handled = handleIncomingPacketQueueItem(item, false);
+		(lastPacketRepeated ? repeatedPacketCycles : packetHandlingCycles).addSince(startCycle);
+		if (handled == false)
 		{
 			logStream().printf("Error in tx pkt %d %02x%02x%02x %u %d %d %d, q %d, r %d\n", item.bitsPresent, item.data[0], item.data[1], item.data[2], item.startCycle, item.validPre, item.validParity, item.validChecksum, uxQueueMessagesWaiting(rxDecoder.getPacketQueue()), ret);
 		}
 	}
 
-	// MQTT payload generation and flushing
-	// render payload
-	DynamicJsonDocument doc(STATE_JSON_MAX_SIZE);
-	doc["ip"] = WiFi.localIP().toString();
-	doc["testPin"] = digitalRead(testPin) == LOW ? "ON" : "OFF";
-	doc["enableTemperatureSync"] = enableTemperatureSync;
-	if (heaterPacketCounter)
+	// census reports are requested over MQTT and sent from here to not block the callback
+	if (censusRequested && mqttClient.connected())
 	{
-		doc["currentTemperature"] = lastHeaterPacketParsed.temperatureCelsius;
-		doc["targetTemperature"] = targetTemperatureCelsius;
-		doc["mode"] = lastHeaterPacketParsed.on ? "heat" : "off";
-		doc["action"] = lastHeaterPacketParsed.inUse ? "heating" : (lastHeaterPacketParsed.on ? "idle" : "off");
-		if (REPORT_RESEARCH_FIELDS)
-		{
-			doc["activeId"] = lastHeaterPacketParsed.activeId;
-			doc["heaterBytes"] = RinnaiProtocolDecoder::renderPacket(lastHeaterPacketBytes);
-			doc["startupState"] = lastHeaterPacketParsed.startupState;
-		}
+		censusRequested = false;
+		publishCensus();
+	}
+
+	captureLog.loop();
+
+	// startup timing is sent once per boot, after the first state
+	if (!bootTimingReported && bootTiming.firstStateMillis)
+	{
+		bootTimingReported = true;
+		publishBootTiming();
+	}
+
+	// usage aggregates are sent as their period closes, the last closed minute and hour wait for the connection
+	RinnaiUsageAggregator::Aggregate aggregate;
+	bool connected = mqttClient.connected();
+	if (connected && usage.takeMinute(aggregate))
+	{
+		publishUsage("minute", aggregate);
+	}
+	if (connected && usage.takeHour(aggregate))
+	{
+		publishUsage("hour", aggregate);
 	}
-	if (localControlPacketCounter && REPORT_RESEARCH_FIELDS)
+
+	const TelemetryProfileSettings &profile = TELEMETRY_PROFILES[telemetryProfile];
+	if (profile.bitActivity && mqttClient.connected() && millis() - lastBitActivityReportMillis > BIT_ACTIVITY_REPORT_INTERVAL_MS)
 	{
-		doc["locControlId"] = lastLocalControlPacketParsed.myId;
-		doc["locControlBytes"] = RinnaiProtocolDecoder::renderPacket(lastLocalControlPacketBytes);
+		lastBitActivityReportMillis = millis();
+		publishBitActivity();
 	}
+
+	// MQTT payload generation and flushing
+	// render payload
+	unsigned int renderStartCycle = CycleCounter::now();
+	DynamicJsonDocument doc(profile.stateJsonSize);
+	renderStateFields(doc, profile.keyFields);
 	String payload;
 	serializeJson(doc, payload);
+	stateRenderCycles.addSince(renderStartCycle);
 	// check if to send
 	unsigned long now = millis();
-	if (mqttClient.connected() && (now - lastMqttReportMillis > MQTT_REPORT_FORCED_FLUSH_INTERVAL_MS || payload != lastMqttReportPayload))
+	bool due = mqttClient.connected() && (now - lastMqttReportMillis > profile.flushIntervalMs || payload != lastMqttReportPayload);
+	// limit the rate of changes. a change that has to wait is sent once a token is available, merged with any that follow it
+	if (due && !stateRateLimiter.tryTake(now))
 	{
-		// now that we have decided to send, expand payload with additional fields that normally don't trigger a send on their own
-		doc["rssi"] = WiFi.RSSI(); // the current RSSI /Received Signal Strength in dBm (?)
-		if (REPORT_RESEARCH_FIELDS)
+		if (payload != lastMqttReportDeferredPayload)
 		{
-			if (heaterPacketCounter)
-			{
-				doc["heaterDelta"] = lastHeaterPacketDeltaMillis;
-			}
-			if (localControlPacketCounter)
-			{
-				doc["locControlTiming"] = millisDeltaPositive(lastLocalControlPacketMillis, lastHeaterPacketMillis, lastHeaterPacketDeltaMillis);
-			}
-			if (remoteControlPacketCounter)
-			{
-				doc["remControlId"] = lastRemoteControlPacketParsed.myId;
-				doc["remControlBytes"] = RinnaiProtocolDecoder::renderPacket(lastRemoteControlPacketBytes);
-				doc["remControlTiming"] = millisDeltaPositive(lastRemoteControlPacketMillis, lastHeaterPacketMillis, lastHeaterPacketDeltaMillis);
-			}
-			if (unknownPacketCounter)
-			{
-				doc["unknownBytes"] = RinnaiProtocolDecoder::renderPacket(lastUnknownPacketBytes);
-				doc["unknownTiming"] = millisDeltaPositive(lastUnknownPacketMillis, lastHeaterPacketMillis, lastHeaterPacketDeltaMillis);
-			}
+			stateMergedCounter++;
+			lastMqttReportDeferredPayload = payload;
 		}
+		due = false;
+	}
+	if (due)
+	{
+		// now that we have decided to send, expand payload with additional fields that normally don't trigger a send on their own
+		renderStateFields(doc, profile.fields & ~profile.keyFields);
 		// re-serialize payload
 		String payloadExpanded;
 		serializeJson(doc, payloadExpanded);
+		// the client buffer holds one MQTT packet, if the other fields do not fit send the key fields alone
+		if ((int)payloadExpanded.length() > MQTTPublisher::getMaxPayloadLength(mqttTopicState))
+		{
+			stateTruncatedCounter++;
+			logStream().printf("State message of %d bytes does not fit in an MQTT packet, sending the %d bytes of key fields only\n", payloadExpanded.length(), payload.length());
+			payloadExpanded = payload;
+		}
 		// send
-		logStream().printf("Sending on MQTT channel '%s': %d/%d bytes, %s\n", mqttTopicState.c_str(), payloadExpanded.length(), STATE_JSON_MAX_SIZE, payloadExpanded.c_str());
-		bool ret = mqttClient.publish(mqttTopicState, payloadExpanded, true, 0);
+		logStream().printf("Sending on MQTT channel '%s': %d/%d bytes, %s\n", mqttTopicState.c_str(), payloadExpanded.length(), profile.stateJsonSize, payloadExpanded.c_str());
+		bool ret = publisher.publish(mqttTopicState, payloadExpanded, true, 0, true); // only the newest state matters
 		if (!ret)
 		{
-			logStream().println("Error publishing a state MQTT message");
+			logStream().println("Error queueing a state MQTT message");
+		}
+		if (ret && bootTiming.firstStateMillis == 0)
+		{
+			bootTiming.firstStateMillis = millis();
 		}
 		lastMqttReportMillis = now;
 		lastMqttReportPayload = payload; // save last (restricted) payload for change detection
+		if (lastMqttReportDeferredPayload == payload) // this one was counted as merged but made it out
+		{
+			stateMergedCounter--;
+		}
+		lastMqttReportDeferredPayload = String();
 	}
 
 	// delay to not over flood the serial interface
 	// delay(100);
 }
 
+// add the state fields of the given groups, fields of sources that were not heard from yet are left out
+void RinnaiMQTTGateway::renderStateFields(DynamicJsonDocument &doc, unsigned int fields)
+{
+	if (fields & FIELDS_DEVICE)
+	{
+		doc["ip"] = WiFi.localIP().toString();
+		doc["testPin"] = digitalRead(testPin) == LOW ? "ON" : "OFF";
+		doc["enableTemperatureSync"] = enableTemperatureSync;
+	}
+	if ((fields & FIELDS_CLIMATE) && heaterPacketCounter)
+	{
+		// report the predicted effect of a pending command right away, heater packets will confirm or roll it back
+		bool on = getModeledOn();
+		doc["currentTemperature"] = getModeledTemperatureCelsius();
+		doc["targetTemperature"] = targetTemperatureCelsius;
+		doc["mode"] = on ? "heat" : "off";
+		doc["action"] = lastHeaterPacketParsed.inUse && on ? "heating" : (on ? "idle" : "off");
+		if (isModelPending())
+		{
+			doc["pending"] = true;
+		}
+	}
+	if (fields & FIELDS_PACKETS)
+	{
+		if (heaterPacketCounter)
+		{
+			doc["activeId"] = lastHeaterPacketParsed.activeId;
+			doc["heaterBytes"] = RinnaiProtocolDecoder::renderPacket(lastHeaterPacketBytes);
+			doc["startupState"] = lastHeaterPacketParsed.startupState;
+		}
+		if (localControlPacketCounter)
+		{
+			doc["locControlId"] = lastLocalControlPacketParsed.myId;
+			doc["locControlBytes"] = RinnaiProtocolDecoder::renderPacket(lastLocalControlPacketBytes);
+		}
+	}
+	if (fields & FIELDS_RSSI)
+	{
+		doc["rssi"] = WiFi.RSSI(); // the current RSSI /Received Signal Strength in dBm (?)
+	}
+	if (fields & FIELDS_DECODER)
+	{
+		doc["rxFrameLoss"] = rxDecoder.getFrameLossPerMille();
+		doc["txFrameLoss"] = txDecoder.getFrameLossPerMille();
+		doc["rxRecovered"] = rxDecoder.getRecoveredPacketCounter();
+		doc["txRecovered"] = txDecoder.getRecoveredPacketCounter();
+		doc["rxCorrected"] = rxDecoder.getCorrectedPacketCounter();
+		doc["txCorrected"] = txDecoder.getCorrectedPacketCounter();
+		doc["rxUncorrectable"] = rxDecoder.getUncorrectablePacketCounter();
+		doc["txUncorrectable"] = txDecoder.getUncorrectablePacketCounter();
+		doc["rxGlitches"] = rxDecoder.getGlitchCounter();
+		doc["txGlitches"] = txDecoder.getGlitchCounter();
+		doc["slotHitRate"] = txDecoder.getSlotTracker().getHitPerMille();
+		doc["slotError"] = txDecoder.getSlotTracker().getMeanErrorMicros();
+	}
+	if (fields & FIELDS_GATEWAY)
+	{
+		doc["overrideOk"] = overrideSuccessCounter;
+		doc["overrideRetry"] = overrideRetryCounter;
+		doc["overrideFail"] = overrideFailureCounter;
+		doc["modelRollbacks"] = modelRollbackCounter;
+		doc["mqttQueue"] = publisher.getQueueDepth();
+		doc["mqttCoalesced"] = publisher.getCoalescedCounter();
+		doc["mqttDropped"] = publisher.getDroppedCounter();
+		doc["stateMerged"] = stateMergedCounter;
+		if (stateTruncatedCounter)
+		{
+			doc["stateTruncated"] = stateTruncatedCounter;
+		}
+		if (captureLog.isEnabled())
+		{
+			doc["captureBytes"] = captureLog.getSize();
+		}
+		if (txDecoder.isEmulating())
+		{
+			doc["emulationId"] = emulationId;
+			doc["emulationPackets"] = txDecoder.getEmulationPacketCounter();
+		}
+	}
+	if (fields & FIELDS_TIMING)
+	{
+		if (heaterPacketCounter)
+		{
+			doc["heaterDelta"] = lastHeaterPacketDeltaMillis;
+		}
+		if (localControlPacketCounter)
+		{
+			doc["locControlTiming"] = millisDeltaPositive(lastLocalControlPacketMillis, lastHeaterPacketMillis, lastHeaterPacketDeltaMillis);
+		}
+		if (remoteControlPacketCounter)
+		{
+			doc["remControlId"] = lastRemoteControlPacketParsed.myId;
+			doc["remControlBytes"] = RinnaiProtocolDecoder::renderPacket(lastRemoteControlPacketBytes);
+			doc["remControlTiming"] = millisDeltaPositive(lastRemoteControlPacketMillis, lastHeaterPacketMillis, lastHeaterPacketDeltaMillis);
+		}
+		if (unknownPacketCounter)
+		{
+			doc["unknownBytes"] = RinnaiProtocolDecoder::renderPacket(lastUnknownPacketBytes);
+			doc["unknownTiming"] = millisDeltaPositive(lastUnknownPacketMillis, lastHeaterPacketMillis, lastHeaterPacketDeltaMillis);
+		}
+	}
+}
+
 bool RinnaiMQTTGateway::handleIncomingPacketQueueItem(const PacketQueueItem &item, bool remote)
 {
+	lastPacketRepeated = false;
+	captureLog.record(item, remote);
 	// check packet is valid
-	if (!item.validPre || !item.validParity || !item.validChecksum)
+	if (!(item.validPre || item.recovered) || !item.validParity || !item.validChecksum)
 	{
 		return false;
 	}
+	census.record(item.data, remote, item.startMillis);
 	// see where the packet originates from
-	RinnaiPacketSource source = RinnaiProtocolDecoder::getPacketSource(item.data, RinnaiSignalDecoder::BYTES_IN_PACKET);
+	// most packets repeat the previous one from the same source, match them on raw bytes and skip decoding
+	RinnaiPacketSource source;
+	if (remote && isRepeatedPacket(item.data, lastHeaterPacketBytes, heaterPacketCounter))
+	{
+		source = HEATER;
+	}
+	else if (isRepeatedPacket(item.data, remote ? lastRemoteControlPacketBytes : lastLocalControlPacketBytes, remote ? remoteControlPacketCounter : localControlPacketCounter))
+	{
+		source = CONTROL;
+	}
+	else if (isRepeatedPacket(item.data, remote ? lastRemoteUnknownPacketBytes : lastLocalUnknownPacketBytes, remote ? remoteUnknownPacketCounter : localUnknownPacketCounter))
+	{
+		source = UNKNOWN;
+	}
+	else
+	{
+		source = RinnaiProtocolDecoder::getPacketSource(item.data, RinnaiSignalDecoder::BYTES_IN_PACKET);
+	}
+	bool repeated = lastPacketRepeated;
 	if (source == INVALID) // bad checksum, size, etc
 	{
 		return false;
 	}
 	else if (source == HEATER && remote)
 	{
-		RinnaiHeaterPacket packet;
-		bool ret = RinnaiProtocolDecoder::decodeHeaterPacket(item.data, packet);
-		if (!ret)
+		if (!repeated)
 		{
-			return false;
+			RinnaiHeaterPacket packet;
+			bool ret = RinnaiProtocolDecoder::decodeHeaterPacket(item.data, packet);
+			if (!ret)
+			{
+				return false;
+			}
+			if (heaterPacketCounter > 0 && TELEMETRY_PROFILES[telemetryProfile].bitActivity)
+			{
+				byte events = (packet.on != lastHeaterPacketParsed.on) |
+							  (packet.inUse != lastHeaterPacketParsed.inUse) << 1 |
+							  (packet.temperatureCelsius != lastHeaterPacketParsed.temperatureCelsius) << 2 |
+							  (packet.activeId != lastHeaterPacketParsed.activeId) << 3;
+				bitActivity.update(RinnaiBitActivity::HEATER_TRACK, lastHeaterPacketBytes, item.data, events);
+			}
+			memcpy(&lastHeaterPacketParsed, &packet, sizeof(RinnaiHeaterPacket));
+			memcpy(lastHeaterPacketBytes, item.data, RinnaiProtocolDecoder::BYTES_IN_PACKET);
 		}
-		memcpy(&lastHeaterPacketParsed, &packet, sizeof(RinnaiHeaterPacket));
-		memcpy(lastHeaterPacketBytes, item.data, RinnaiProtocolDecoder::BYTES_IN_PACKET);
 		// counters and timings
 		unsigned long t = item.startMillis;
 		if (heaterPacketCounter > 0)
@@ -176,79 +441,460 @@ bool RinnaiMQTTGateway::handleIncomingPacketQueueItem(const PacketQueueItem &ite
 		}
 		heaterPacketCounter++;
 		lastHeaterPacketMillis = t;
+		if (bootTiming.firstHeaterPacketMillis == 0)
+		{
+			bootTiming.firstHeaterPacketMillis = millis();
+		}
+		usage.update(lastHeaterPacketParsed, t);
 		// init target temperature once we have reports from the heater
 		if (targetTemperatureCelsius == -1)
 		{
 			targetTemperatureCelsius = lastHeaterPacketParsed.temperatureCelsius; 
 		}
-		// act on temperature info
+		// verify pending commands, then act on temperature info
+		handleOverrideTransaction();
 		handleTemperatureSync();
 		// log
 		if (logLevel == PARSED)
 		{
-			logStream().printf("Heater packet: a=%d o=%d u=%d t=%d\n", packet.activeId, packet.on, packet.inUse, packet.temperatureCelsius);
+			logStream().printf("Heater packet: a=%d o=%d u=%d t=%d\n", lastHeaterPacketParsed.activeId, lastHeaterPacketParsed.on, lastHeaterPacketParsed.inUse, lastHeaterPacketParsed.temperatureCelsius);
 		}
 	}
 	else if (source == CONTROL)
 	{
-		RinnaiControlPacket packet;
-		bool ret = RinnaiProtocolDecoder::decodeControlPacket(item.data, packet);
-		if (!ret)
+		RinnaiControlPacket &lastPacket = remote ? lastRemoteControlPacketParsed : lastLocalControlPacketParsed;
+		if (!repeated)
 		{
-			return false;
+			RinnaiControlPacket packet;
+			bool ret = RinnaiProtocolDecoder::decodeControlPacket(item.data, packet);
+			if (!ret)
+			{
+				return false;
+			}
+			if ((remote ? remoteControlPacketCounter : localControlPacketCounter) && TELEMETRY_PROFILES[telemetryProfile].bitActivity)
+			{
+				byte events = (packet.onOffPressed != lastPacket.onOffPressed) |
+							  (packet.priorityPressed != lastPacket.priorityPressed) << 1 |
+							  (packet.temperatureUpPressed != lastPacket.temperatureUpPressed) << 2 |
+							  (packet.temperatureDownPressed != lastPacket.temperatureDownPressed) << 3;
+				bitActivity.update(remote ? RinnaiBitActivity::REMOTE_CONTROL_TRACK : RinnaiBitActivity::LOCAL_CONTROL_TRACK, remote ? lastRemoteControlPacketBytes : lastLocalControlPacketBytes, item.data, events);
+			}
+			memcpy(&lastPacket, &packet, sizeof(RinnaiControlPacket));
+			memcpy(remote ? lastRemoteControlPacketBytes : lastLocalControlPacketBytes, item.data, RinnaiProtocolDecoder::BYTES_IN_PACKET);
 		}
 		if (remote)
 		{
-			memcpy(&lastRemoteControlPacketParsed, &packet, sizeof(RinnaiControlPacket));
-			memcpy(lastRemoteControlPacketBytes, item.data, RinnaiProtocolDecoder::BYTES_IN_PACKET);
 			remoteControlPacketCounter++;
 			lastRemoteControlPacketMillis = item.startMillis;
 		}
 		else
 		{
-			memcpy(&lastLocalControlPacketParsed, &packet, sizeof(RinnaiControlPacket));
-			memcpy(lastLocalControlPacketBytes, item.data, RinnaiProtocolDecoder::BYTES_IN_PACKET);
 			localControlPacketCounter++;
 			lastLocalControlPacketMillis = item.startMillis;
 		}
 		// log
 		if (logLevel == PARSED)
 		{
-			logStream().printf("Control packet: r=%d i=%d o=%d p=%d td=%d tu=%d\n", remote, packet.myId, packet.onOffPressed, packet.priorityPressed, packet.temperatureDownPressed, packet.temperatureUpPressed);
+			logStream().printf("Control packet: r=%d i=%d o=%d p=%d td=%d tu=%d\n", remote, lastPacket.myId, lastPacket.onOffPressed, lastPacket.priorityPressed, lastPacket.temperatureDownPressed, lastPacket.temperatureUpPressed);
 		}
 	}
 	else // source == UNKNOWN || local HEATER
 	{
 		// save metrics for troubleshooting and research
 		memcpy(lastUnknownPacketBytes, item.data, RinnaiProtocolDecoder::BYTES_IN_PACKET);
+		memcpy(remote ? lastRemoteUnknownPacketBytes : lastLocalUnknownPacketBytes, item.data, RinnaiProtocolDecoder::BYTES_IN_PACKET);
 		unknownPacketCounter++;
+		if (remote)
+		{
+			remoteUnknownPacketCounter++;
+		}
+		else
+		{
+			localUnknownPacketCounter++;
+		}
 		lastUnknownPacketMillis = item.startMillis;
 	}
+	if (repeated)
+	{
+		repeatedPacketCounter++;
+	}
 	return true;
 }
 
+// same bytes as the last packet seen from this source
+bool RinnaiMQTTGateway::isRepeatedPacket(const byte *data, const byte *lastData, int counter)
+{
+	lastPacketRepeated = counter > 0 && memcmp(data, lastData, RinnaiProtocolDecoder::BYTES_IN_PACKET) == 0;
+	return lastPacketRepeated;
+}
+
+// send all census entries, a few per message
+void RinnaiMQTTGateway::publishCensus()
+{
+	int pages = (census.getSize() + CENSUS_ENTRIES_PER_MESSAGE - 1) / CENSUS_ENTRIES_PER_MESSAGE;
+	int page = 0;
+	int slot = 0;
+	do
+	{
+		DynamicJsonDocument doc(CENSUS_JSON_MAX_SIZE);
+		doc["page"] = page;
+		doc["pages"] = pages;
+		doc["size"] = census.getSize();
+		doc["evictions"] = census.getEvictionCounter();
+		JsonArray entries = doc.createNestedArray("entries");
+		int count = 0;
+		for (; slot < RinnaiPacketCensus::CAPACITY && count < CENSUS_ENTRIES_PER_MESSAGE; slot++)
+		{
+			const RinnaiPacketCensus::Entry &entry = census.getSlot(slot);
+			if (!entry.used)
+			{
+				continue;
+			}
+			count++;
+			JsonObject e = entries.createNestedObject();
+			e["bus"] = entry.remote ? "rx" : "tx";
+			e["bytes"] = RinnaiProtocolDecoder::renderPacket(entry.data);
+			e["count"] = entry.count;
+			e["firstSeen"] = entry.firstSeenMillis;
+			e["lastSeen"] = entry.lastSeenMillis;
+		}
+		String payload;
+		serializeJson(doc, payload);
+		logStream().printf("Sending on MQTT channel '%s/census_report': %d/%d bytes, %s\n", mqttTopic.c_str(), payload.length(), CENSUS_JSON_MAX_SIZE, payload.c_str());
+		bool ret = publisher.publish(mqttTopic + "/census_report", payload);
+		if (!ret)
+		{
+			logStream().println("Error queueing a census MQTT message");
+		}
+		page++;
+	} while (page < pages);
+}
+
+void RinnaiMQTTGateway::publishBootTiming()
+{
+	DynamicJsonDocument doc(BOOT_JSON_MAX_SIZE);
+	doc["resetReason"] = (int)esp_reset_reason();
+	doc["restored"] = snapshotRestored;
+	doc["decodersReady"] = bootTiming.decodersReadyMillis;
+	doc["wifiConnected"] = bootTiming.wifiConnectedMillis;
+	doc["mqttConnected"] = bootTiming.mqttConnectedMillis;
+	if (bootTiming.firstHeaterPacketMillis)
+	{
+		doc["firstHeaterPacket"] = bootTiming.firstHeaterPacketMillis;
+	}
+	doc["firstState"] = bootTiming.firstStateMillis;
+	String payload;
+	serializeJson(doc, payload);
+	logStream().printf("Sending on MQTT channel '%s/boot': %d/%d bytes, %s\n", mqttTopic.c_str(), payload.length(), BOOT_JSON_MAX_SIZE, payload.c_str());
+	bool ret = publisher.publish(mqttTopic + "/boot", payload);
+	if (!ret)
+	{
+		logStream().println("Error queueing a boot MQTT message");
+	}
+}
+
+void RinnaiMQTTGateway::publishUsage(const char *period, const RinnaiUsageAggregator::Aggregate &aggregate)
+{
+	if (!mqttClient.connected())
+	{
+		return;
+	}
+	DynamicJsonDocument doc(USAGE_JSON_MAX_SIZE);
+	doc["period"] = period;
+	doc["start"] = aggregate.startMillis;
+	doc["seconds"] = aggregate.coveredMillis / 1000.0;
+	doc["onSeconds"] = aggregate.onMillis / 1000.0;
+	doc["heatingSeconds"] = aggregate.inUseMillis / 1000.0;
+	doc["ignitions"] = aggregate.ignitions;
+	if (aggregate.coveredMillis)
+	{
+		doc["meanSetpoint"] = (float)aggregate.setpointMillis / aggregate.coveredMillis;
+	}
+	String payload;
+	serializeJson(doc, payload);
+	logStream().printf("Sending on MQTT channel '%s/usage': %d/%d bytes, %s\n", mqttTopic.c_str(), payload.length(), USAGE_JSON_MAX_SIZE, payload.c_str());
+	bool ret = publisher.publish(mqttTopic + "/usage", payload);
+	if (!ret)
+	{
+		logStream().println("Error queueing a usage MQTT message");
+	}
+}
+
+// send the toggle counts of the bits that changed, a few bits per message for every track
+void RinnaiMQTTGateway::publishBitActivity()
+{
+	const char *trackNames[RinnaiBitActivity::TRACKS] = {"heater", "locControl", "remControl"};
+	for (int t = 0; t < RinnaiBitActivity::TRACKS; t++)
+	{
+		RinnaiBitActivity::Track track = (RinnaiBitActivity::Track)t;
+		int toggledBits = 0;
+		for (int bit = 0; bit < RinnaiBitActivity::BITS; bit++)
+		{
+			toggledBits += bitActivity.getToggleCounter(track, bit) != 0;
+		}
+		int pages = (toggledBits + BIT_ACTIVITY_BITS_PER_MESSAGE - 1) / BIT_ACTIVITY_BITS_PER_MESSAGE;
+		int page = 0;
+		int bit = 0;
+		do
+		{
+			DynamicJsonDocument doc(BIT_ACTIVITY_JSON_MAX_SIZE);
+			doc["source"] = trackNames[t];
+			doc["changes"] = bitActivity.getChangeCounter(track);
+			doc["page"] = page;
+			doc["pages"] = pages;
+			JsonObject bits = doc.createNestedObject("bits");
+			int count = 0;
+			for (; bit < RinnaiBitActivity::BITS && count < BIT_ACTIVITY_BITS_PER_MESSAGE; bit++)
+			{
+				if (bitActivity.getToggleCounter(track, bit) == 0)
+				{
+					continue;
+				}
+				count++;
+				// "byte.bit": [toggles, toggles with event 0, ... event 3]
+				char key[8];
+				snprintf(key, sizeof(key), "%d.%d", bit / 8, bit % 8);
+				JsonArray counters = bits.createNestedArray(key);
+				counters.add(bitActivity.getToggleCounter(track, bit));
+				for (int event = 0; event < RinnaiBitActivity::EVENTS; event++)
+				{
+					counters.add(bitActivity.getEventToggleCounter(track, bit, event));
+				}
+			}
+			if (doc.overflowed())
+			{
+				logStream().printf("Bit activity of %s does not fit in %d bytes\n", trackNames[t], BIT_ACTIVITY_JSON_MAX_SIZE);
+			}
+			String payload;
+			serializeJson(doc, payload);
+			logStream().printf("Sending on MQTT channel '%s/bit_activity': %d/%d bytes, %s\n", mqttTopic.c_str(), payload.length(), BIT_ACTIVITY_JSON_MAX_SIZE, payload.c_str());
+			bool ret = publisher.publish(mqttTopic + "/bit_activity", payload);
+			if (!ret)
+			{
+				logStream().println("Error queueing a bit activity MQTT message");
+			}
+			page++;
+		} while (page < pages);
+	}
+}
+
 void RinnaiMQTTGateway::handleTemperatureSync()
 {
-	if (heaterPacketCounter && localControlPacketCounter && targetTemperatureCelsius != -1 &&
+	if (heaterPacketCounter && (localControlPacketCounter || txDecoder.isEmulating()) && targetTemperatureCelsius != -1 && !overrideTransaction.active && overrideQueueLength == 0 &&
 		lastHeaterPacketParsed.temperatureCelsius != targetTemperatureCelsius && millis() - lastHeaterPacketMillis < MAX_OVERRIDE_PERIOD_FROM_ORIGINAL_MS)
 	{
 		override(lastHeaterPacketParsed.temperatureCelsius < targetTemperatureCelsius ? TEMPERATURE_UP : TEMPERATURE_DOWN);
 	}
 }
 
+// start an override command and track it until the heater shows its effect
+// a command that comes while another one is pending is queued and started once that one ends
 bool RinnaiMQTTGateway::override(OverrideCommand command)
+{
+	if (!overrideTransaction.active && overrideQueueLength == 0)
+	{
+		return startOverride(command);
+	}
+	if (command == ON_OFF && overrideQueueLength > 0 && overrideQueue[overrideQueueLength - 1] == ON_OFF) // two toggles cancel out
+	{
+		overrideQueueLength--;
+		return true;
+	}
+	if (overrideQueueLength == OVERRIDE_QUEUE_SIZE)
+	{
+		logStream().printf("Override queue is full, dropping command %d\n", command);
+		overrideFailureCounter++;
+		return false;
+	}
+	if (overrideQueueLength == 0)
+	{
+		overrideQueueHeaterPackets = 0;
+	}
+	overrideQueue[overrideQueueLength++] = command;
+	return true;
+}
+
+bool RinnaiMQTTGateway::startOverride(OverrideCommand command)
+{
+	if (!sendOverride(command))
+	{
+		return false;
+	}
+	overrideTransaction.active = true;
+	overrideTransaction.command = command;
+	overrideTransaction.attempts = 1;
+	overrideTransaction.onBefore = lastHeaterPacketParsed.on;
+	overrideTransaction.temperatureCelsiusBefore = lastHeaterPacketParsed.temperatureCelsius;
+	return true;
+}
+
+// called on every heater packet
+void RinnaiMQTTGateway::handleOverrideTransaction()
+{
+	if (!overrideTransaction.active)
+	{
+		startQueuedOverride();
+		return;
+	}
+	// was it sent?
+	if (txDecoder.getOverrideCounter() == overrideTransaction.overrideCounter)
+	{
+		// the previous press showed up late, sending the retry would press again (and toggle on/off back)
+		bool lateEffect = overrideTransaction.attempts > 1 && isOverrideEffective();
+		if (lateEffect)
+		{
+			txDecoder.cancelOverridePacket();
+		}
+		if (txDecoder.getOverrideCounter() == overrideTransaction.overrideCounter) // else it went out while we cancelled
+		{
+			if (lateEffect)
+			{
+				logStream().printf("Override command %d took effect late, cancelled the retry\n", overrideTransaction.command);
+				overrideSuccessCounter++;
+				overrideTransaction.active = false;
+			}
+			else if (++overrideTransaction.heaterPacketsWaiting >= OVERRIDE_SEND_MAX_HEATER_PACKETS) // no panel packet to ride on
+			{
+				logStream().printf("Override command %d was not sent, giving up\n", overrideTransaction.command);
+				txDecoder.cancelOverridePacket();
+				overrideFailureCounter++;
+				if (isModelPending())
+				{
+					modelRollbackCounter++;
+				}
+				overrideTransaction.active = false;
+			}
+			return;
+		}
+	}
+	// did it work?
+	overrideTransaction.heaterPacketsSinceSent++;
+	if (isOverrideEffective())
+	{
+		overrideSuccessCounter++;
+		overrideTransaction.active = false;
+	}
+	else if (overrideTransaction.heaterPacketsSinceSent >= getVerifyHeaterPackets(overrideTransaction.command)) // the press was lost, try again on the next slot
+	{
+		if (overrideTransaction.attempts < MAX_OVERRIDE_ATTEMPTS && sendOverride(overrideTransaction.command))
+		{
+			logStream().printf("Override command %d had no effect, retrying\n", overrideTransaction.command);
+			overrideTransaction.attempts++;
+			overrideRetryCounter++;
+		}
+		else
+		{
+			logStream().printf("Override command %d had no effect after %d attempts\n", overrideTransaction.command, overrideTransaction.attempts);
+			overrideFailureCounter++;
+			if (isModelPending())
+			{
+				modelRollbackCounter++;
+			}
+			overrideTransaction.active = false;
+		}
+	}
+}
+
+// a queued command waits for a control panel packet to ride on, like a direct one, then gives up
+void RinnaiMQTTGateway::startQueuedOverride()
+{
+	if (overrideQueueLength == 0)
+	{
+		return;
+	}
+	OverrideCommand command = overrideQueue[0];
+	bool started = startOverride(command);
+	if (!started && ++overrideQueueHeaterPackets < OVERRIDE_SEND_MAX_HEATER_PACKETS)
+	{
+		return;
+	}
+	if (!started)
+	{
+		logStream().printf("Queued override command %d could not be sent, giving up\n", command);
+		overrideFailureCounter++;
+	}
+	overrideQueueLength--;
+	memmove(overrideQueue, overrideQueue + 1, overrideQueueLength * sizeof(overrideQueue[0]));
+	overrideQueueHeaterPackets = 0;
+}
+
+byte RinnaiMQTTGateway::getVerifyHeaterPackets(OverrideCommand command)
+{
+	return command == ON_OFF ? OVERRIDE_VERIFY_ON_OFF_HEATER_PACKETS : OVERRIDE_VERIFY_HEATER_PACKETS;
+}
+
+// see if the last heater packet reflects the pending override
+bool RinnaiMQTTGateway::isOverrideEffective()
+{
+	switch (overrideTransaction.command)
+	{
+	case ON_OFF:
+		return lastHeaterPacketParsed.on != overrideTransaction.onBefore;
+	case TEMPERATURE_UP:
+		return lastHeaterPacketParsed.temperatureCelsius > overrideTransaction.temperatureCelsiusBefore;
+	case TEMPERATURE_DOWN:
+		return lastHeaterPacketParsed.temperatureCelsius < overrideTransaction.temperatureCelsiusBefore;
+	case PRIORITY:
+	default:
+		return true; // no visible effect, being sent is all we can check
+	}
+}
+
+// the heater state is modeled as the last heater packet with the expected effect of the pending command applied
+bool RinnaiMQTTGateway::isModelPending()
+{
+	return overrideTransaction.active && overrideTransaction.command != PRIORITY;
+}
+
+bool RinnaiMQTTGateway::getModeledOn()
+{
+	bool on = lastHeaterPacketParsed.on;
+	if (isModelPending() && overrideTransaction.command == ON_OFF)
+	{
+		on = !overrideTransaction.onBefore;
+	}
+	for (int i = 0; i < overrideQueueLength; i++)
+	{
+		if (overrideQueue[i] == ON_OFF)
+		{
+			on = !on;
+		}
+	}
+	return on;
+}
+
+// temperature presses are sent one by one until the target is reached, so predict the target
+byte RinnaiMQTTGateway::getModeledTemperatureCelsius()
+{
+	if (isModelPending() && overrideTransaction.command != ON_OFF && targetTemperatureCelsius != -1)
+	{
+		return targetTemperatureCelsius;
+	}
+	return lastHeaterPacketParsed.temperatureCelsius;
+}
+
+// build an override packet from the last local control panel packet and hand it to the proxy
+bool RinnaiMQTTGateway::sendOverride(OverrideCommand command)
 {
 	// check if state is valid for sending
 	unsigned long originalControlPacketAge = millis() - lastLocalControlPacketMillis;
-	if (originalControlPacketAge > MAX_OVERRIDE_PERIOD_FROM_ORIGINAL_MS) // if we have no recent original packet. can happen because no panel signal is available
+	if (!txDecoder.isEmulating() && originalControlPacketAge > MAX_OVERRIDE_PERIOD_FROM_ORIGINAL_MS) // if we have no recent original packet. can happen because no panel signal is available
 	{
 		logStream().printf("No fresh original data for override command %d, age %lu, millis %lu, lastLocal %lu\n", command, originalControlPacketAge, millis(), lastLocalControlPacketMillis);
 		return false;
 	}
 	// logStream().printf("Attempting override command %d, age %d\n", command, originalControlPacketAge);
 	// prep buffer
+	unsigned int buildStartCycle = CycleCounter::now();
 	byte buf[RinnaiSignalDecoder::BYTES_IN_PACKET];
-	memcpy(buf, lastLocalControlPacketBytes, RinnaiSignalDecoder::BYTES_IN_PACKET);
+	if (txDecoder.isEmulating()) // we are the panel
+	{
+		RinnaiProtocolDecoder::buildControlPacket(buf, emulationId);
+	}
+	else
+	{
+		memcpy(buf, lastLocalControlPacketBytes, RinnaiSignalDecoder::BYTES_IN_PACKET);
+	}
 	switch (command)
 	{
 	case ON_OFF:
@@ -267,12 +913,16 @@ bool RinnaiMQTTGateway::override(OverrideCommand command)
 		logStream().println("Unknown command for override");
 		return false;
 	}
+	overrideBuildCycles.addSince(buildStartCycle);
 	bool overRet = txDecoder.setOverridePacket(buf, RinnaiSignalDecoder::BYTES_IN_PACKET);
 	if (overRet == false)
 	{
 		logStream().printf("Error setting override, command = %d\n", command); // are we hammering too fast?
 		return false;
 	}
+	overrideTransaction.overrideCounter = txDecoder.getOverrideCounter();
+	overrideTransaction.heaterPacketsSinceSent = 0;
+	overrideTransaction.heaterPacketsWaiting = 0;
 	return true;
 }
 
@@ -291,7 +941,7 @@ void RinnaiMQTTGateway::onMqttMessageReceived(String &fullTopic, String &payload
 	}
 
 	// ignore what we send
-	if (topic == "config" || topic == "state" || topic == "availability")
+	if (topic == "config" || topic == "state" || topic == "availability" || topic == "census_report" || topic == "bit_activity" || topic == "usage" || topic == "boot")
 	{
 		return;
 	}
@@ -308,6 +958,7 @@ void RinnaiMQTTGateway::onMqttMessageReceived(String &fullTopic, String &payload
 		temp = max(temp, (int)RinnaiProtocolDecoder::TEMP_C_MIN);
 		logStream().printf("Setting %d as target temperature\n", temp);
 		targetTemperatureCelsius = temp;
+		saveSnapshot();
 	}
 	else if (topic == "temperature_sync")
 	{
@@ -319,10 +970,12 @@ void RinnaiMQTTGateway::onMqttMessageReceived(String &fullTopic, String &payload
 		{
 			enableTemperatureSync = false; // in case something breaks and you want to take control manually at the panel
 		}
+		saveSnapshot();
 	}
 	else if (topic == "mode")
 	{
-		if ((payload == "off" && lastHeaterPacketParsed.on) || (payload == "heat" && !lastHeaterPacketParsed.on))
+		bool on = getModeledOn(); // includes a press that is still pending or queued
+		if ((payload == "off" && on) || (payload == "heat" && !on))
 		{
 			override(ON_OFF);
 		}
@@ -331,6 +984,97 @@ void RinnaiMQTTGateway::onMqttMessageReceived(String &fullTopic, String &payload
 	{
 		override(PRIORITY);
 	}
+	else if (topic == "emulation")
+	{
+		// "off" or the control panel id to use, e.g. "0" to replace the local panel
+		if (payload == "off")
+		{
+			logStream().println("Stopping control panel emulation");
+			txDecoder.setEmulationPacket(NULL, 0);
+		}
+		else
+		{
+			emulationId = atoi(payload.c_str());
+			byte buf[RinnaiSignalDecoder::BYTES_IN_PACKET];
+			RinnaiProtocolDecoder::buildControlPacket(buf, emulationId);
+			bool ret = txDecoder.setEmulationPacket(buf, RinnaiSignalDecoder::BYTES_IN_PACKET);
+			logStream().printf("Starting control panel emulation with id %d, %d\n", emulationId, ret);
+		}
+	}
+	else if (topic == "state_rate")
+	{
+		// "intervalMs,burst", "0" to not limit
+		unsigned long intervalMs = 0;
+		unsigned int burst = STATE_RATE_BURST;
+		if (sscanf(payload.c_str(), "%lu,%u", &intervalMs, &burst) < 1) // a typo must not turn the limit off
+		{
+			logStream().printf("Invalid state rate: %s\n", payload.c_str());
+		}
+		else
+		{
+			logStream().printf("Setting state rate to a burst of %u then one per %lu ms\n", burst, intervalMs);
+			stateRateLimiter.configure(burst > 0 ? burst : 1, intervalMs);
+		}
+	}
+	else if (topic == "capture")
+	{
+		if (payload == "clear")
+		{
+			captureLog.clear();
+		}
+		else
+		{
+			captureLog.setEnabled(payload == "on" || payload == "enable" || payload == "true" || payload == "1");
+		}
+	}
+	else if (topic == "census")
+	{
+		if (payload == "clear")
+		{
+			census.clear();
+		}
+		else
+		{
+			censusRequested = true;
+		}
+	}
+	else if (topic == "error_correction")
+	{
+		bool enabled = payload == "on" || payload == "enable" || payload == "true" || payload == "1";
+		logStream().printf("Setting error correction to %d\n", enabled);
+		rxDecoder.setErrorCorrection(enabled);
+		txDecoder.setErrorCorrection(enabled);
+	}
+	else if (topic == "glitch_filter")
+	{
+		// minimal pulse width in us, 0 to turn off
+		unsigned int minPulseUs = atoi(payload.c_str());
+		logStream().printf("Setting glitch filter to %u us\n", minPulseUs);
+		rxDecoder.setGlitchFilter(minPulseUs);
+		txDecoder.setGlitchFilter(minPulseUs);
+	}
+	else if (topic == "isr_benchmark")
+	{
+		// number of edges to make on ISR_BENCHMARK_PIN, blocks the loop for about 0.1 ms per edge
+		int samples = atoi(payload.c_str());
+		if (samples <= 0 || samples > ISR_BENCHMARK_MAX_SAMPLES)
+		{
+			samples = ISR_BENCHMARK_MAX_SAMPLES;
+		}
+		int missed = RinnaiSignalDecoder::runISRBenchmark(samples);
+		CycleCounter &entry = RinnaiSignalDecoder::getISREntryCycles();
+		CycleCounter &handler = RinnaiSignalDecoder::getISRCycles();
+		logStream().printf("ISR benchmark: entry %u ns avg, %u ns max, %u ops, %d missed, handler %u ns avg, %u ns max\n", entry.getAverageNanos(), entry.getMaxNanos(), entry.getCount(), missed, handler.getAverageNanos(), handler.getMaxNanos());
+	}
+	else if (topic == "noise")
+	{
+		// "jitterUs,glitchPerMille,dropPerMille,invertPerMille", used to measure decoding robustness, "0,0,0,0" to turn off
+		NoiseInjection noise = {0, 0, 0, 0};
+		sscanf(payload.c_str(), "%u,%u,%u,%u", &noise.jitterUs, &noise.glitchPerMille, &noise.dropPerMille, &noise.invertPerMille);
+		logStream().printf("Setting noise injection to jitter %u us, glitch %u, drop %u, invert %u per mille\n", noise.jitterUs, noise.glitchPerMille, noise.dropPerMille, noise.invertPerMille);
+		rxDecoder.setNoiseInjection(noise);
+		txDecoder.setNoiseInjection(noise);
+	}
 	else if (topic == "log_level")
 	{
 		if (payload == "none")
@@ -345,6 +1089,24 @@ void RinnaiMQTTGateway::onMqttMessageReceived(String &fullTopic, String &payload
 		{
 			logLevel = RAW;
 		}
+		saveSnapshot();
+	}
+	else if (topic == "telemetry")
+	{
+		int profile = 0;
+		while (profile < TELEMETRY_PROFILE_COUNT && payload != TELEMETRY_PROFILES[profile].name)
+		{
+			profile++;
+		}
+		if (profile == TELEMETRY_PROFILE_COUNT)
+		{
+			logStream().printf("Unknown telemetry profile: %s\n", payload.c_str());
+			return;
+		}
+		logStream().printf("Setting telemetry profile to %s\n", TELEMETRY_PROFILES[profile].name);
+		telemetryProfile = (TelemetryProfile)profile;
+		lastMqttReportPayload = String(); // send the new set of fields right away
+		saveSnapshot();
 	}
 	else if (topic == "log_destination")
 	{
@@ -399,16 +1161,16 @@ void RinnaiMQTTGateway::onMqttConnected()
 	String payload;
 	serializeJson(doc, payload);
 	logStream().printf("Sending on MQTT channel '%s/config': %d/%d bytes, %s\n", mqttTopic.c_str(), payload.length(), CONFIG_JSON_MAX_SIZE, payload.c_str());
-	ret = mqttClient.publish(mqttTopic + "/config", payload, true, 0);
+	ret = publisher.publish(mqttTopic + "/config", payload, true, 0, true);
 	if (!ret)
 	{
-		logStream().println("Error publishing a config MQTT message");
+		logStream().println("Error queueing a config MQTT message");
 	}
 	// send an availability topic to signal that we are available
-	ret = mqttClient.publish(mqttTopic + "/availability", "online", true, 0);
+	ret = publisher.publish(mqttTopic + "/availability", "online", true, 0, true);
 	if (!ret)
 	{
-		logStream().println("Error publishing an availability MQTT message");
+		logStream().println("Error queueing an availability MQTT message");
 	}
 }
 
@@ -0,0 +1,56 @@
+#include "RinnaiNoiseInjector.hpp"
+
+const int INJECTED_GLITCH_MAX_US = 50;
+
+void RinnaiNoiseInjector::configure(const NoiseInjection &noise)
+{
+	this->noise = noise;
+	enabled = noise.jitterUs > 0 || noise.glitchPerMille > 0 || noise.dropPerMille > 0 || noise.invertPerMille > 0;
+}
+
+bool RinnaiNoiseInjector::isMissed()
+{
+	return enabled && esp_random() % 1000 < noise.dropPerMille;
+}
+
+void RinnaiNoiseInjector::apply(PulseQueueItem &pulse)
+{
+	if (!enabled)
+	{
+		return;
+	}
+	unsigned int cycle = pulse.value & ~PULSE_LEVEL_MASK;
+	byte newLevel = pulse.value & PULSE_LEVEL_MASK;
+	// timing jitter
+	if (noise.jitterUs > 0)
+	{
+		int jitterUs = (int)(esp_random() % (noise.jitterUs * 2 + 1)) - (int)noise.jitterUs;
+		cycle += microsecondsToClockCycles(jitterUs);
+	}
+	// wrong level
+	if (esp_random() % 1000 < noise.invertPerMille)
+	{
+		newLevel = !newLevel;
+	}
+	pulse.value = (cycle & ~PULSE_LEVEL_MASK) | newLevel;
+	// short spike after the edge
+	if (esp_random() % 1000 < noise.glitchPerMille)
+	{
+		unsigned int glitchStartCycle = cycle + microsecondsToClockCycles(1 + esp_random() % INJECTED_GLITCH_MAX_US);
+		unsigned int glitchEndCycle = glitchStartCycle + microsecondsToClockCycles(1 + esp_random() % INJECTED_GLITCH_MAX_US);
+		injectedPulses[0].value = (glitchStartCycle & ~PULSE_LEVEL_MASK) | !newLevel;
+		injectedPulses[1].value = (glitchEndCycle & ~PULSE_LEVEL_MASK) | newLevel;
+		injectedPulseCount = 2;
+	}
+}
+
+bool RinnaiNoiseInjector::takeInjectedPulse(PulseQueueItem &pulse)
+{
+	if (injectedPulseCount == 0)
+	{
+		return false;
+	}
+	pulse = injectedPulses[sizeof(injectedPulses) / sizeof(injectedPulses[0]) - injectedPulseCount];
+	injectedPulseCount--;
+	return true;
+}
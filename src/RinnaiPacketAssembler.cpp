@@ -0,0 +1,146 @@
+#include "RinnaiPacketAssembler.hpp"
+
+const unsigned int MAX_RESYNC_SLIP_SYMBOLS = 4; // how many extra symbols a recovered packet may have after its anchor
+
+RinnaiPacketAssembler::RinnaiPacketAssembler()
+{
+	memset(&packet, 0, sizeof(packet));
+}
+
+PacketAssemblerEvent RinnaiPacketAssembler::push(const BitQueueItem &bit)
+{
+	BIT symbol = (BIT)(bit.value & BIT_SYMBOL_MASK);
+	if (symbol == PRE || (bit.value & BIT_GAP_MASK))
+	{
+		if (symbol != PRE) // damaged preamble
+		{
+			errorCounter++;
+		}
+		// anchor a new packet
+		anchored = true;
+		damaged = symbol != PRE;
+		bitsSinceAnchor = 0;
+		window = 0;
+		packet.startCycle = bit.value & ~(BIT_SYMBOL_MASK | BIT_GAP_MASK);
+		packet.validPre = symbol == PRE;
+		return PACKET_ANCHORED;
+	}
+	if (!anchored || symbol == ERROR)
+	{
+		// keep the anchor, a later window may skip over this symbol
+		damaged = true;
+		errorCounter++;
+		return NO_EVENT;
+	}
+	// shift the bit into the window
+	window = (window >> 1) | ((uint64_t)(symbol == SYM1) << (BITS_IN_PACKET - 1));
+	bitsSinceAnchor++;
+	if (bitsSinceAnchor < BITS_IN_PACKET)
+	{
+		return NO_EVENT;
+	}
+	for (int i = 0; i < BYTES_IN_PACKET; i++)
+	{
+		packet.data[i] = window >> (i * 8);
+	}
+	packet.bitsPresent = BITS_IN_PACKET;
+	validatePacket(packet);
+	bool valid = isValid(packet);
+	// the window that starts right at the anchor is aligned, try to repair a single flipped bit in it
+	if (!valid && bitsSinceAnchor == BITS_IN_PACKET)
+	{
+		if (errorCorrectionEnabled && correctSingleBitError(packet))
+		{
+			valid = true;
+			correctedPacketCounter++;
+		}
+		else
+		{
+			uncorrectablePacketCounter++;
+		}
+	}
+	bool clean = bitsSinceAnchor == BITS_IN_PACKET && !damaged;
+	// send clean packets even if invalid so errors are reported, and recovered ones only if valid
+	if (!clean && !valid)
+	{
+		if (bitsSinceAnchor >= BITS_IN_PACKET + MAX_RESYNC_SLIP_SYMBOLS)
+		{
+			anchored = false;
+		}
+		return NO_EVENT;
+	}
+	packet.recovered = valid && !(clean && packet.validPre);
+	if (valid)
+	{
+		validPacketCounter++;
+		if (packet.recovered)
+		{
+			recoveredPacketCounter++;
+		}
+		anchored = false;
+	}
+	return PACKET_READY;
+}
+
+void RinnaiPacketAssembler::clearCounters()
+{
+	validPacketCounter = 0;
+	recoveredPacketCounter = 0;
+	correctedPacketCounter = 0;
+	uncorrectablePacketCounter = 0;
+}
+
+// every byte, including the checksum, has odd parity and the xor of all bytes is 0
+// a single flipped bit shows as the only byte with even parity and the only bit set in the xor, flip it back
+bool RinnaiPacketAssembler::correctSingleBitError(PacketQueueItem &packet)
+{
+	byte column = 0;
+	int badByte = -1;
+	for (int i = 0; i < BYTES_IN_PACKET; i++)
+	{
+		column ^= packet.data[i];
+		if (!isOddParity(packet.data[i]))
+		{
+			if (badByte != -1) // more than one error
+			{
+				return false;
+			}
+			badByte = i;
+		}
+	}
+	if (badByte == -1 || column == 0 || (column & (column - 1)) != 0) // not exactly one byte and one bit
+	{
+		return false;
+	}
+	packet.data[badByte] ^= column;
+	validatePacket(packet);
+	return isValid(packet);
+}
+
+// check parity (each data byte has "odd parity bit" as the MSB bit) and checksum (last byte is xor of first 5 bytes)
+void RinnaiPacketAssembler::validatePacket(PacketQueueItem &packet)
+{
+	packet.validParity = true; // be optimistic
+	for (int i = 0; i < BYTES_IN_PACKET - 1; i++)
+	{
+		if (!isOddParity(packet.data[i]))
+		{
+			packet.validParity = false;
+		}
+	}
+	byte checksum = 0;
+	for (int i = 0; i < BYTES_IN_PACKET; i++)
+	{
+		checksum ^= packet.data[i];
+	}
+	packet.validChecksum = checksum == 0;
+}
+
+bool RinnaiPacketAssembler::isOddParity(byte b)
+{
+	// https://stackoverflow.com/questions/21617970/how-to-check-if-value-has-even-parity-of-bits-or-odd
+	b ^= b >> 4;
+	b ^= b >> 2;
+	b ^= b >> 1;
+	return b & 1;
+}
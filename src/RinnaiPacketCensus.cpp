@@ -0,0 +1,97 @@
+#include "RinnaiPacketCensus.hpp"
+
+const unsigned int FNV_OFFSET_BASIS = 2166136261u;
+const unsigned int FNV_PRIME = 16777619u;
+
+// count a packet, adding it if it is a new variant
+void RinnaiPacketCensus::record(const byte *data, bool remote, unsigned long millis)
+{
+	int slot = hash(data, remote) & (CAPACITY - 1);
+	while (slots[slot].used)
+	{
+		if (matches(slots[slot], data, remote))
+		{
+			slots[slot].count++;
+			slots[slot].lastSeenMillis = millis;
+			return;
+		}
+		slot = (slot + 1) & (CAPACITY - 1);
+	}
+	// new variant
+	if (size >= MAX_ENTRIES)
+	{
+		evictOldest();
+		record(data, remote, millis); // the eviction may have moved entries, probe again
+		return;
+	}
+	Entry &entry = slots[slot];
+	memcpy(entry.data, data, sizeof(entry.data));
+	entry.used = true;
+	entry.remote = remote;
+	entry.count = 1;
+	entry.firstSeenMillis = millis;
+	entry.lastSeenMillis = millis;
+	size++;
+}
+
+void RinnaiPacketCensus::clear()
+{
+	memset(slots, 0, sizeof(slots));
+	size = 0;
+	evictionCounter = 0;
+}
+
+// FNV-1a of the bytes and the bus
+unsigned int RinnaiPacketCensus::hash(const byte *data, bool remote)
+{
+	unsigned int h = FNV_OFFSET_BASIS;
+	for (int i = 0; i < RinnaiProtocolDecoder::BYTES_IN_PACKET; i++)
+	{
+		h = (h ^ data[i]) * FNV_PRIME;
+	}
+	return (h ^ remote) * FNV_PRIME;
+}
+
+bool RinnaiPacketCensus::matches(const Entry &entry, const byte *data, bool remote)
+{
+	return entry.remote == remote && memcmp(entry.data, data, sizeof(entry.data)) == 0;
+}
+
+// only runs when a new variant shows up on a full table, so a scan is fine
+void RinnaiPacketCensus::evictOldest()
+{
+	int oldest = -1;
+	unsigned long now = millis();
+	for (int i = 0; i < CAPACITY; i++)
+	{
+		if (slots[i].used && (oldest == -1 || now - slots[i].lastSeenMillis > now - slots[oldest].lastSeenMillis))
+		{
+			oldest = i;
+		}
+	}
+	if (oldest != -1)
+	{
+		remove(oldest);
+		evictionCounter++;
+	}
+}
+
+// backward shift deletion, keeps every entry reachable from its home slot without tombstones
+void RinnaiPacketCensus::remove(int slot)
+{
+	int hole = slot;
+	int next = (hole + 1) & (CAPACITY - 1);
+	while (slots[next].used)
+	{
+		int home = hash(slots[next].data, slots[next].remote) & (CAPACITY - 1);
+		// move the entry back if the hole lies between its home slot and where it is now
+		if (((next - home) & (CAPACITY - 1)) >= ((next - hole) & (CAPACITY - 1)))
+		{
+			slots[hole] = slots[next];
+			hole = next;
+		}
+		next = (next + 1) & (CAPACITY - 1);
+	}
+	slots[hole].used = false;
+	size--;
+}
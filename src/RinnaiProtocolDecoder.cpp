@@ -2,6 +2,8 @@
 
 const byte TEMP_MAX_CODE = 0xe; // the max valid code
 const byte TEMP_CODE[] = {37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 50, 55, 60};
+const byte CONTROL_IDLE_BYTE_3 = 0x5f; // observed on idle control panels, meaning unknown
+const byte CONTROL_BYTE_4 = 0xbf;
 
 RinnaiPacketSource RinnaiProtocolDecoder::getPacketSource(const byte *data, int length)
 {
@@ -100,6 +102,17 @@ void RinnaiProtocolDecoder::calcAndSetChecksum(byte *data)
 	data[BYTES_IN_PACKET - 1] = checksum;
 }
 
+// build the packet of an idle control panel (no buttons pressed), as seen on the bus
+void RinnaiProtocolDecoder::buildControlPacket(byte *data, byte myId)
+{
+	data[0] = myId & 0xf;
+	data[1] = 0;
+	data[2] = 0;
+	data[3] = CONTROL_IDLE_BYTE_3;
+	data[4] = CONTROL_BYTE_4;
+	calcAndSetChecksum(data);
+}
+
 void RinnaiProtocolDecoder::setOnOffPressed(byte *data)
 {
 	data[1] |= 0x01; // set button bit
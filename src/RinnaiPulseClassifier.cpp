@@ -0,0 +1,73 @@
+#include "RinnaiPulseClassifier.hpp"
+
+const int FRAME_GAP_MIN_US = 5000; // a low period this long can only be the gap between packets
+
+// edges out of order (a missed edge) resync on the next edge instead of dropping the pairing
+bool RinnaiPulseClassifier::push(const PulseQueueItem &pulse, BitQueueItem &bit)
+{
+	unsigned int cycle = pulse.value & ~PULSE_LEVEL_MASK;
+	if (pulse.value & PULSE_LEVEL_MASK) // rise
+	{
+		if (waitingForFall) // missed a fall, start over from this rise
+		{
+			errorCounter++;
+		}
+		risingCycle = cycle;
+		waitingForFall = true;
+		return false;
+	}
+	if (!waitingForFall) // missed a rise, measure the next low period from this fall
+	{
+		errorCounter++;
+		lastEndCycle = cycle;
+		return false;
+	}
+	waitingForFall = false;
+	unsigned int fallingCycle = cycle;
+	// a spike on the low line, ignore it as if the low period went on
+	if (fallingCycle - risingCycle < glitchFilterCycles)
+	{
+		glitchCounter++;
+		return false;
+	}
+	// we have 3 relevant timings: lastEndCycle, risingCycle and fallingCycle
+	// convert
+	unsigned long pulseLengthLow = clockCyclesToMicroseconds(risingCycle - lastEndCycle);
+	unsigned long pulseLengthHigh = clockCyclesToMicroseconds(fallingCycle - risingCycle);
+	// a long low period is the gap between packets, count it to know how many packets we should have decoded
+	bool afterGap = pulseLengthLow > FRAME_GAP_MIN_US;
+	if (afterGap)
+	{
+		frameSlotCounter++;
+	}
+	// decide on what to register
+	BIT symbol = classifySymbol(pulseLengthLow, pulseLengthHigh);
+	bit.value = ((symbol == PRE || afterGap ? risingCycle : lastEndCycle) & ~(BIT_SYMBOL_MASK | BIT_GAP_MASK)) | symbol | (afterGap ? BIT_GAP_MASK : 0);
+	// save last for next iteration
+	lastEndCycle = fallingCycle;
+	return true;
+}
+
+// classify a low period followed by a high period into a symbol
+BIT RinnaiPulseClassifier::classifySymbol(unsigned long pulseLengthLow, unsigned long pulseLengthHigh)
+{
+	if (pulseLengthHigh > SYMBOL_DURATION_US && SYMBOL_DURATION_US < SYMBOL_DURATION_US * 2) // if valid pre pulse
+	{
+		return PRE;
+	}
+	else if (pulseLengthLow > SYMBOL_SHORT_PERIOD_RATIO_MIN && pulseLengthLow < SYMBOL_SHORT_PERIOD_RATIO_MAX && pulseLengthHigh > SYMBOL_LONG_PERIOD_RATIO_MIN && pulseLengthHigh < SYMBOL_LONG_PERIOD_RATIO_MAX)
+	{
+		return SYM1;
+	}
+	else if (pulseLengthLow > SYMBOL_LONG_PERIOD_RATIO_MIN && pulseLengthLow < SYMBOL_LONG_PERIOD_RATIO_MAX && pulseLengthHigh > SYMBOL_SHORT_PERIOD_RATIO_MIN && pulseLengthHigh < SYMBOL_SHORT_PERIOD_RATIO_MAX)
+	{
+		return SYM0;
+	}
+	return ERROR;
+}
+
+// minimal width of a high pulse, shorter ones are dropped as glitches. 0 to turn off.
+void RinnaiPulseClassifier::setGlitchFilter(unsigned int minPulseUs)
+{
+	glitchFilterCycles = microsecondsToClockCycles(minPulseUs);
+}
@@ -1,45 +1,61 @@
 #include "LogStream.hpp"
 #include "RinnaiSignalDecoder.hpp"
 
-const int PULSES_IN_BIT = 2;
-const int BITS_IN_PACKET = RinnaiSignalDecoder::BYTES_IN_PACKET * 8;
-const int MAX_PACKETS_IN_QUEUE = 3;
-
-const int TASK_STACK_DEPTH = 2000; // minimum is configMINIMAL_STACK_SIZE
 const int BIT_TASK_PRIORITY = 1;   // Each task can have a priority between 0 and 24. The upper limit is defined by configMAX_PRIORITIES. The priority of the main loop is 1.
 const int PACKET_TASK_PRIORITY = 1;
 const int OVERRIDE_TASK_PRIORITY = 4; // high priority task, will block others while it is running
 
-const int SYMBOL_DURATION_US = 600;
-
 const int INIT_PULSE = 850;
 const int SHORT_PULSE = 150;
 const int LONG_PULSE = 450;
 
-const int SYMBOL_SHORT_PERIOD_RATIO_MIN = SYMBOL_DURATION_US * 15 / 100;
-const int SYMBOL_SHORT_PERIOD_RATIO_MAX = SYMBOL_DURATION_US * 35 / 100;
-const int SYMBOL_LONG_PERIOD_RATIO_MIN = SYMBOL_DURATION_US * 65 / 100;
-const int SYMBOL_LONG_PERIOD_RATIO_MAX = SYMBOL_DURATION_US * 85 / 100;
+const int GLITCH_FILTER_MIN_PULSE_US = 50; // the shortest valid pulse is SHORT_PULSE
+const unsigned int GLITCH_FILTER_MAX_US = 500; // must stay below a tick, see takeHeldEdge
+const TickType_t HELD_EDGE_MIN_TICKS = 2; // a held edge this old can no longer be the start of a glitch
 
 // cycles of 200ms and 250ms were observed. A packet is 30ms long. Allow for 10ms of margin.
 const int PERIOD_BETWEEN_TX_PACKETS_MARGIN = 10000; // us
 const int EXPECTED_PERIOD_BETWEEN_TX_PACKETS_MIN = 200000 - 30000 - PERIOD_BETWEEN_TX_PACKETS_MARGIN; // us
 const int EXPECTED_PERIOD_BETWEEN_TX_PACKETS_MAX = 250000 - 30000 + PERIOD_BETWEEN_TX_PACKETS_MARGIN; // us
 
+const int EMULATION_DEFAULT_PERIOD_US = 200000; // used until we have seen the real panel
+const int EMULATION_POLL_MS = 100; // how fast the override task notices that emulation was turned on
+const int EMULATION_SPIN_MS = 2; // busy wait this much before a slot, for an exact start
+const int OVERRIDE_ARM_MAX_MS = EMULATION_SPIN_MS + 1; // take the output only when the predicted slot is this close
+
+const int ISR_BENCHMARK_TIMEOUT_US = 1000; // an edge the ISR did not see by then is counted as missed
+const int ISR_BENCHMARK_GAP_US = 100; // between benchmark edges
+
 enum BitTaskState
 {
 	WAIT_PRE,
 	WAIT_SYMBOL,
 };
 
+RinnaiSignalDecoder *RinnaiSignalDecoder::decoders[MAX_DECODERS];
+int RinnaiSignalDecoder::decoderCount = 0;
+intr_handle_t RinnaiSignalDecoder::isrHandle = NULL;
+CycleCounter RinnaiSignalDecoder::isrCycles;
+CycleCounter RinnaiSignalDecoder::isrEntryCycles;
+unsigned int RinnaiSignalDecoder::benchmarkPinMask = 0;
+bool RinnaiSignalDecoder::benchmarkLevel = false;
+volatile bool RinnaiSignalDecoder::benchmarkPending = false;
+volatile unsigned int RinnaiSignalDecoder::benchmarkTriggerCycle = 0;
+
 RinnaiSignalDecoder::RinnaiSignalDecoder(const byte pin, const byte proxyOutPin, const bool invertIn, const bool invertOut)
-	: pin(pin), proxyOutPin(proxyOutPin), invertIn(invertIn), invertOut(invertOut)
+	: isrHandler(&RinnaiSignalDecoder::pulseISRHandler), pin(pin), proxyOutPin(proxyOutPin), invertIn(invertIn), invertOut(invertOut), pinMask(1 << (pin % 32)), pinInBank1(pin >= 32)
 {
+	setGlitchFilter(GLITCH_FILTER_MIN_PULSE_US);
 }
 
 // return true is setup is ok
 bool RinnaiSignalDecoder::setup()
 {
+	if (decoderCount >= MAX_DECODERS)
+	{
+		logStream().printf("Error adding decoder, max is %d\n", MAX_DECODERS);
+		return false;
+	}
 	// setup input pin
 	// pinMode(pin, INPUT); // too basic
 	gpio_pad_select_gpio(pin);
@@ -54,103 +70,207 @@ bool RinnaiSignalDecoder::setup()
 		digitalWrite(proxyOutPin, digitalRead(pin) ^ invertIn ^ invertOut); // outputting LOW will signal that we are ready to receive
 	}
 
+	// create queues and tasks, all storage is part of this object so this can't fail
+	pulseQueue = xQueueCreateStatic(PULSE_QUEUE_LENGTH, sizeof(PulseQueueItem), pulseQueueStorage, &pulseQueueBuffer);
+	bitQueue = xQueueCreateStatic(BIT_QUEUE_LENGTH, sizeof(BitQueueItem), bitQueueStorage, &bitQueueBuffer);
+	packetQueue = xQueueCreateStatic(PACKET_QUEUE_LENGTH, sizeof(PacketQueueItem), packetQueueStorage, &packetQueueBuffer);
+	// create pulse to bit task
+	bitTask = xTaskCreateStatic([](void *o) { static_cast<RinnaiSignalDecoder *>(o)->bitTaskHandler(); },
+								"bit task",
+								BIT_TASK_STACK_DEPTH,
+								this,
+								BIT_TASK_PRIORITY,
+								bitTaskStack,
+								&bitTaskBuffer);
+	// create byte to packet task
+	packetTask = xTaskCreateStatic([](void *o) { static_cast<RinnaiSignalDecoder *>(o)->packetTaskHandler(); },
+								   "packet task",
+								   PACKET_TASK_STACK_DEPTH,
+								   this,
+								   PACKET_TASK_PRIORITY,
+								   packetTaskStack,
+								   &packetTaskBuffer);
+	// create packet override task
+	// pinned to the core that will run the ISR, so both use the same cycle counter when scheduling emulated packets
+	overrideTask = xTaskCreateStaticPinnedToCore([](void *o) { static_cast<RinnaiSignalDecoder *>(o)->overrideTaskHandler(); },
+												 "override task",
+												 OVERRIDE_TASK_STACK_DEPTH,
+												 this,
+												 OVERRIDE_TASK_PRIORITY,
+												 overrideTaskStack,
+												 &overrideTaskBuffer,
+												 xPortGetCoreID());
+
 	// create interrupts
 	// attachInterrupt(); // too basic
 	// use either gpio_isr_register (global ISR for all pins) or gpio_install_isr_service + gpio_isr_handler_add (per pin)
-	esp_err_t ret_isr;
-	ret_isr = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);	   // ESP_INTR_FLAG_IRAM -> code is in RAM -> allows the interrupt to run even during flash operations
-	if (ret_isr != ESP_OK && ret_isr != ESP_ERR_INVALID_STATE) // ESP_ERR_INVALID_STATE -> already initialized
+	// we use a single global ISR that reads the gpio registers once and serves all decoders
+#ifdef ISR_PER_PIN // the per pin dispatch of ESP-IDF, only built to compare its latency with the shared ISR
+	esp_err_t ret_isr = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+	if (ret_isr == ESP_OK || ret_isr == ESP_ERR_INVALID_STATE) // installed by the first decoder
 	{
-		logStream().printf("Error installing isr, %d\n", ret_isr);
-		return false;
+		ret_isr = gpio_isr_handler_add((gpio_num_t)pin, &RinnaiSignalDecoder::perPinISRHandler, this);
 	}
-	ret_isr = gpio_isr_handler_add((gpio_num_t)pin, &RinnaiSignalDecoder::pulseISRHandler, this);
 	if (ret_isr != ESP_OK)
 	{
-		logStream().printf("Error adding isr handler, %d\n", ret_isr);
+		logStream().printf("Error registering isr, %d\n", ret_isr);
 		return false;
 	}
-	// create pulse queue
-	pulseQueue = xQueueCreate(MAX_PACKETS_IN_QUEUE * BITS_IN_PACKET * PULSES_IN_BIT, sizeof(PulseQueueItem)); // every bit is two pulses (not including "pre" overhead)
-	if (pulseQueue == 0)
+#else
+	if (isrHandle == NULL)
 	{
-		logStream().printf("Error creating queue\n");
-		return false;
+		esp_err_t ret_isr = gpio_isr_register(&RinnaiSignalDecoder::sharedISRHandler, NULL, ESP_INTR_FLAG_IRAM, &isrHandle); // ESP_INTR_FLAG_IRAM -> code is in RAM -> allows the interrupt to run even during flash operations
+		if (ret_isr != ESP_OK)
+		{
+			logStream().printf("Error registering isr, %d\n", ret_isr);
+			return false;
+		}
 	}
-	// create bit queue
-	bitQueue = xQueueCreate(MAX_PACKETS_IN_QUEUE * BITS_IN_PACKET, sizeof(BitQueueItem));
-	if (bitQueue == 0)
+#endif
+	decoders[decoderCount++] = this; // from here on the ISR will serve this decoder
+	logMemoryBudget();
+	// return
+	return true;
+}
+
+void RinnaiSignalDecoder::logMemoryBudget()
+{
+	logStream().printf("Decoder on pin %d: %u bytes of RAM, queues %u, tasks %u\n", pin, sizeof(RinnaiSignalDecoder), QUEUES_RAM, TASKS_RAM);
+}
+
+// the least free stack each task had so far, only meaningful after some traffic went through all of them
+void RinnaiSignalDecoder::logStackUsage()
+{
+	if (bitTask && packetTask && overrideTask)
 	{
-		logStream().printf("Error creating queue\n");
-		return false;
+		logStream().printf("Decoder on pin %d: free stack bit %u/%d, packet %u/%d, override %u/%d\n", pin, uxTaskGetStackHighWaterMark(bitTask), BIT_TASK_STACK_DEPTH, uxTaskGetStackHighWaterMark(packetTask), PACKET_TASK_STACK_DEPTH, uxTaskGetStackHighWaterMark(overrideTask), OVERRIDE_TASK_STACK_DEPTH);
 	}
-	// create packet queue
-	packetQueue = xQueueCreate(MAX_PACKETS_IN_QUEUE, sizeof(PacketQueueItem));
-	if (packetQueue == 0)
+}
+
+// serve all decoders from a single interrupt, reading the gpio registers once
+// all edges handled in one call get the same timestamp
+void IRAM_ATTR RinnaiSignalDecoder::sharedISRHandler(void *)
+{
+	unsigned int cycle = xthal_get_ccount();
+	// read state
+	unsigned int status = GPIO.status;
+	unsigned int status1 = GPIO.status1.intr_st;
+	unsigned int in = GPIO.in;
+	unsigned int in1 = GPIO.in1.data;
+	// we are the only gpio ISR so clear everything that triggered us
+	GPIO.status_w1tc = status;
+	GPIO.status1_w1tc.intr_st = status1;
+	if (benchmarkPending && (status & benchmarkPinMask))
 	{
-		logStream().printf("Error creating queue\n");
-		return false;
+		recordBenchmarkEntryFromISR(cycle);
 	}
-	// log
-	logStream().printf("Created queues, now about to create tasks\n");
-	// create pulse to bit task
-	BaseType_t ret;
-	ret = xTaskCreate([](void *o) { static_cast<RinnaiSignalDecoder *>(o)->bitTaskHandler(); },
-					  "bit task",
-					  TASK_STACK_DEPTH,
-					  this,
-					  BIT_TASK_PRIORITY,
-					  &bitTask);
-	if (ret != pdPASS)
-	{
-		logStream().printf("Error creating task, %d\n", ret);
-		return false;
+	// dispatch to the decoders whose pins changed
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+	bool dispatched = false;
+	for (int i = 0; i < decoderCount; i++)
+	{
+		RinnaiSignalDecoder *decoder = decoders[i];
+		if ((decoder->pinInBank1 ? status1 : status) & decoder->pinMask)
+		{
+			decoder->isrHandler(decoder, cycle, in, in1, xHigherPriorityTaskWoken);
+			dispatched = true;
+		}
 	}
-	// create byte to packet task
-	ret = xTaskCreate([](void *o) { static_cast<RinnaiSignalDecoder *>(o)->packetTaskHandler(); },
-					  "packet task",
-					  TASK_STACK_DEPTH,
-					  this,
-					  PACKET_TASK_PRIORITY,
-					  &packetTask);
-	if (ret != pdPASS)
-	{
-		logStream().printf("Error creating task, %d\n", ret);
-		return false;
+	if (dispatched) // benchmark edges alone would make the handler look cheaper than it is
+	{
+		isrCycles.addSince(cycle);
 	}
-	// create packet override task
-	ret = xTaskCreate([](void *o) { static_cast<RinnaiSignalDecoder *>(o)->overrideTaskHandler(); },
-					  "override task",
-					  TASK_STACK_DEPTH,
-					  this,
-					  OVERRIDE_TASK_PRIORITY,
-					  &overrideTask);
-	if (ret != pdPASS)
-	{
-		logStream().printf("Error creating task, %d\n", ret);
-		return false;
+	// do context switch if it was requested
+	if (xHigherPriorityTaskWoken)
+	{
+		portYIELD_FROM_ISR();
 	}
-	// return
-	return true;
 }
 
-// forward calls to a member function
-void IRAM_ATTR RinnaiSignalDecoder::pulseISRHandler(void *arg)
+// one decoder per call, ESP-IDF has already read and cleared the interrupt status
+void IRAM_ATTR RinnaiSignalDecoder::perPinISRHandler(void *arg)
 {
-	static_cast<RinnaiSignalDecoder *>(arg)->pulseISRHandler();
+	unsigned int cycle = xthal_get_ccount();
+	RinnaiSignalDecoder *decoder = static_cast<RinnaiSignalDecoder *>(arg);
+	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+	decoder->isrHandler(decoder, cycle, GPIO.in, GPIO.in1.data, xHigherPriorityTaskWoken);
+	isrCycles.addSince(cycle);
+	if (xHigherPriorityTaskWoken)
+	{
+		portYIELD_FROM_ISR();
+	}
 }
 
-// https://www.reddit.com/r/esp32/comments/f529hf/results_comparing_the_speeds_of_different_gpio/
-int IRAM_ATTR gpio_get_level_IRAM(int gpio_num)
+void IRAM_ATTR RinnaiSignalDecoder::benchmarkISRHandler(void *)
 {
-	if (gpio_num < 32)
+	unsigned int cycle = xthal_get_ccount();
+	if (benchmarkPending)
 	{
-		return (GPIO.in >> gpio_num) & 0x1;
+		recordBenchmarkEntryFromISR(cycle);
 	}
-	else
+}
+
+void IRAM_ATTR RinnaiSignalDecoder::recordBenchmarkEntryFromISR(unsigned int cycle)
+{
+	isrEntryCycles.add(cycle - benchmarkTriggerCycle);
+	benchmarkPending = false;
+}
+
+// measures the time from an edge to the start of the ISR, edges are made by writing to a free pin set as both output and input
+// call after the decoders are set up, from the core that set them up, so the trigger and the ISR read the same cycle counter
+bool RinnaiSignalDecoder::setupISRBenchmark(byte benchmarkPin)
+{
+	if (benchmarkPin >= 32)
+	{
+		logStream().printf("Error, the ISR benchmark pin %d must be below 32\n", benchmarkPin);
+		return false;
+	}
+	gpio_pad_select_gpio(benchmarkPin);
+	gpio_set_direction((gpio_num_t)benchmarkPin, GPIO_MODE_INPUT_OUTPUT);
+	GPIO.out_w1tc = 1 << benchmarkPin;
+	benchmarkLevel = false;
+	gpio_set_intr_type((gpio_num_t)benchmarkPin, GPIO_INTR_ANYEDGE);
+#ifdef ISR_PER_PIN
+	gpio_isr_handler_add((gpio_num_t)benchmarkPin, &RinnaiSignalDecoder::benchmarkISRHandler, NULL);
+#endif
+	benchmarkPinMask = 1 << benchmarkPin;
+	gpio_intr_enable((gpio_num_t)benchmarkPin);
+	return true;
+}
+
+// toggle the benchmark pin a number of times, returns the number of edges the ISR did not see
+int RinnaiSignalDecoder::runISRBenchmark(int samples)
+{
+	if (benchmarkPinMask == 0)
+	{
+		return samples;
+	}
+	isrEntryCycles.reset();
+	int missed = 0;
+	for (int i = 0; i < samples; i++)
 	{
-		return (GPIO.in1.data >> (gpio_num - 32)) & 0x1;
+		benchmarkPending = true;
+		benchmarkLevel = !benchmarkLevel;
+		benchmarkTriggerCycle = xthal_get_ccount();
+		if (benchmarkLevel)
+		{
+			GPIO.out_w1ts = benchmarkPinMask;
+		}
+		else
+		{
+			GPIO.out_w1tc = benchmarkPinMask;
+		}
+		unsigned int waitStart = xthal_get_ccount();
+		while (benchmarkPending && xthal_get_ccount() - waitStart < microsecondsToClockCycles(ISR_BENCHMARK_TIMEOUT_US))
+			;
+		if (benchmarkPending)
+		{
+			benchmarkPending = false;
+			missed++;
+		}
+		delayMicroseconds(ISR_BENCHMARK_GAP_US);
 	}
+	return missed;
 }
 
 // https://www.reddit.com/r/esp32/comments/f529hf/results_comparing_the_speeds_of_different_gpio/
@@ -180,36 +300,99 @@ void IRAM_ATTR gpio_set_level_IRAM(int gpio_num, int level)
 	}
 }
 
-// handle pulse raise and falls
-void IRAM_ATTR RinnaiSignalDecoder::pulseISRHandler()
+// handle pulse raise and falls, pins and polarity are taken from the runtime properties
+void IRAM_ATTR RinnaiSignalDecoder::pulseISRHandler(RinnaiSignalDecoder *decoder, unsigned int cycle, unsigned int in, unsigned int in1, BaseType_t &xHigherPriorityTaskWoken)
 {
-	BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-	// read state
-	PulseQueueItem item;
-	item.cycle = xthal_get_ccount();
-	//item.newLevel = gpio_get_level((gpio_num_t)pin); // not IRAM safe
-	item.newLevel = (bool)gpio_get_level_IRAM(pin) ^ invertIn;
+	//byte newLevel = gpio_get_level((gpio_num_t)pin); // not IRAM safe
+	byte newLevel = (bool)((decoder->pinInBank1 ? in1 : in) & decoder->pinMask) ^ decoder->invertIn;
+	if (decoder->isGlitchFromISR(newLevel))
+	{
+		return;
+	}
 	// track changes to output
-	if (proxyOutPin != INVALID_PIN && !isOverriding) // if overriding proxy is enabled and we are not already overriding
+	if (decoder->proxyOutPin != INVALID_PIN && decoder->checkMirrorFromISR(cycle, newLevel, xHigherPriorityTaskWoken)) // if overriding proxy is enabled and we are not overriding
+	{
+		gpio_set_level_IRAM(decoder->proxyOutPin, newLevel ^ decoder->invertOut); // mirror
+	}
+	decoder->queuePulseFromISR(cycle, newLevel, xHigherPriorityTaskWoken);
+}
+
+// see if we need to start overriding, returns true if the edge should be mirrored to the proxy output
+bool IRAM_ATTR RinnaiSignalDecoder::checkMirrorFromISR(unsigned int cycle, byte newLevel, BaseType_t &xHigherPriorityTaskWoken)
+{
+	if (isOverriding || emulationEnabled) // if we are already overriding or the output is all ours
+	{
+		return false;
+	}
+	if (overridePacketSet && newLevel) // if there is override data and it is a rise
 	{
-		// see if we need to start overriding
-		if (overridePacketSet && item.newLevel) // if there is override data and it is a rise
+		bool isPacketStart;
+		if (slotTracker.isLocked()) // the override task takes the output ahead of the slot, this only catches a task that was late
+		{
+			isPacketStart = slotTracker.isSlotStart(cycle);
+		}
+		else // fall back to the expected quiet time since the previous packet
+		{
+			unsigned int delta = clockCyclesToMicroseconds(cycle - lastPulseCycle);
+			isPacketStart = delta > EXPECTED_PERIOD_BETWEEN_TX_PACKETS_MIN && delta < EXPECTED_PERIOD_BETWEEN_TX_PACKETS_MAX;
+		}
+		if (isPacketStart) // and if timings match
 		{
-			unsigned int delta = clockCyclesToMicroseconds(item.cycle - lastPulseCycle);
-			if (delta > EXPECTED_PERIOD_BETWEEN_TX_PACKETS_MIN && delta < EXPECTED_PERIOD_BETWEEN_TX_PACKETS_MAX) // and if timings match
+			portENTER_CRITICAL_ISR(&overrideMux);
+			bool claimed = !isOverriding;
+			isOverriding = true;
+			portEXIT_CRITICAL_ISR(&overrideMux);
+			if (claimed)
 			{
-				isOverriding = true;
 				// unblock high priority override task
 				// use notifications https://www.freertos.org/RTOS-task-notifications.html, they are faster than semaphores
 				vTaskNotifyGiveFromISR(overrideTask, &xHigherPriorityTaskWoken);
 			}
+			return false; // the override task owns the output from here on
 		}
-		if (!isOverriding) // only if we didn't start an override task above
-		{
-			gpio_set_level_IRAM(proxyOutPin, item.newLevel ^ invertOut); // mirror
-		}
 	}
-	lastPulseCycle = item.cycle;
+	return true;
+}
+
+// drop pulses shorter than the glitch filter, high or low, before they take space in the pulse queue
+// each edge is held until the next one shows how long its pulse was, the bit task takes it if no edge follows
+void IRAM_ATTR RinnaiSignalDecoder::queuePulseFromISR(unsigned int cycle, byte newLevel, BaseType_t &xHigherPriorityTaskWoken)
+{
+	lastPulseCycle = cycle;
+	PulseQueueItem item;
+	item.value = (cycle & ~PULSE_LEVEL_MASK) | newLevel;
+	portENTER_CRITICAL_ISR(&heldEdgeMux);
+	PulseQueueItem held = heldEdge;
+	bool hasHeld = heldEdgeSet;
+	if (hasHeld && cycle - held.value < glitchFilterCycles) // the held edge and this one are a glitch, the level is back to where it was
+	{
+		heldEdgeSet = false;
+		glitchCounter++;
+		portEXIT_CRITICAL_ISR(&heldEdgeMux);
+		return;
+	}
+	bool holdItem = glitchFilterCycles != 0;
+	heldEdge = item;
+	heldEdgeTick = xTaskGetTickCountFromISR();
+	heldEdgeSet = holdItem;
+	portEXIT_CRITICAL_ISR(&heldEdgeMux);
+	// the held edge is older than anything the bit task can take, so the order is kept
+	if (hasHeld)
+	{
+		sendPulseFromISR(held, xHigherPriorityTaskWoken);
+	}
+	if (!holdItem)
+	{
+		sendPulseFromISR(item, xHigherPriorityTaskWoken);
+	}
+	else // the bit task waits on a notification while the filter is on, see receiveEdge
+	{
+		vTaskNotifyGiveFromISR(bitTask, &xHigherPriorityTaskWoken);
+	}
+}
+
+void IRAM_ATTR RinnaiSignalDecoder::sendPulseFromISR(const PulseQueueItem &item, BaseType_t &xHigherPriorityTaskWoken)
+{
 	// send pulse to queue
 	BaseType_t ret = xQueueSendToBackFromISR(pulseQueue, &item, &xHigherPriorityTaskWoken);
 	// ret: pdTRUE = 1; errQUEUE_FULL = 0;
@@ -218,203 +401,231 @@ void IRAM_ATTR RinnaiSignalDecoder::pulseISRHandler()
 		// ets_printf("xQueueSendToBackFromISR %d\n", ret);
 		pulseHandlerErrorCounter++;
 	}
-	// do context switch if it was requested
-	if (xHigherPriorityTaskWoken)
-	{
-		portYIELD_FROM_ISR();
-	}
 }
 
-// start each iteration assuming pin is low
-// wait for switch to HIGH, then to LOW. measure length.
-// have timeouts in place
+// turn edges into symbols
 void RinnaiSignalDecoder::bitTaskHandler()
 {
 	logStream().println("bitTaskHandler started");
 	PulseQueueItem pulse; // we read these, process and push data to the bit queue
-	unsigned int lastEndCycle = 0;
+	BitQueueItem value;
 	for (;;)
 	{
-		// assume next edge is rise
-		BaseType_t ret = xQueueReceive(pulseQueue, &pulse, portMAX_DELAY); // pdTRUE if an item was successfully received from the queue, otherwise pdFALSE.
-		if (ret != pdTRUE || pulse.newLevel != 1)						   // if not rise or can't pull from queue
+		BaseType_t ret = receivePulse(pulse); // pdTRUE if an item was successfully received from the queue, otherwise pdFALSE.
+		if (ret != pdTRUE) // if can't pull from queue
 		{
 			bitTaskErrorCounter++;
+			continue;
 		}
-		else
+		if (!pulseClassifier.push(pulse, value))
 		{
-			unsigned int risingCycle = pulse.cycle;
-			// wait for fall
-			ret = xQueueReceive(pulseQueue, &pulse, portMAX_DELAY); // pdTRUE if an item was successfully received from the queue, otherwise pdFALSE.
-			if (ret != pdTRUE || pulse.newLevel != 0)
-			{
-				bitTaskErrorCounter++;
-			}
-			else
-			{
-				unsigned int fallingCycle = pulse.cycle;
-				// we have 3 relevant timings: lastEndCycle, risingCycle and fallingCycle
-				// convert
-				unsigned long pulseLengthLow = clockCyclesToMicroseconds(risingCycle - lastEndCycle);
-				unsigned long pulseLengthHigh = clockCyclesToMicroseconds(fallingCycle - risingCycle);
-				// decide on what to register
-				BitQueueItem value;																		 // what to register?
-				if (pulseLengthHigh > SYMBOL_DURATION_US && SYMBOL_DURATION_US < SYMBOL_DURATION_US * 2) // if valid pre pulse
-				{
-					// register a "pre"
-					value.bit = PRE;
-					value.startCycle = risingCycle;
-					value.misc = pulseLengthHigh;
-				}
-				else if (pulseLengthLow > SYMBOL_SHORT_PERIOD_RATIO_MIN && pulseLengthLow < SYMBOL_SHORT_PERIOD_RATIO_MAX && pulseLengthHigh > SYMBOL_LONG_PERIOD_RATIO_MIN && pulseLengthHigh < SYMBOL_LONG_PERIOD_RATIO_MAX)
-				{
-					value.bit = SYM1;
-					value.startCycle = lastEndCycle;
-					value.misc = pulseLengthLow;
-				}
-				else if (pulseLengthLow > SYMBOL_LONG_PERIOD_RATIO_MIN && pulseLengthLow < SYMBOL_LONG_PERIOD_RATIO_MAX && pulseLengthHigh > SYMBOL_SHORT_PERIOD_RATIO_MIN && pulseLengthHigh < SYMBOL_SHORT_PERIOD_RATIO_MAX)
-				{
-					value.bit = SYM0;
-					value.startCycle = lastEndCycle;
-					value.misc = pulseLengthLow;
-				}
-				else
-				{
-					value.bit = ERROR;
-					value.startCycle = lastEndCycle;
-					value.misc = pulseLengthLow;
-				}
-				// register
-				BaseType_t ret = xQueueSendToBack(bitQueue, &value, 0); // no wait
-				if (ret != pdTRUE)
-				{
-					// inc error counter
-					bitTaskErrorCounter++;
-				}
-			}
-			// save last for next iteration
-			lastEndCycle = pulse.cycle;
+			continue;
+		}
+		// register
+		ret = xQueueSendToBack(bitQueue, &value, 0); // no wait
+		if (ret != pdTRUE)
+		{
+			// inc error counter
+			bitTaskErrorCounter++;
+		}
+	}
+}
+
+// drop edges that repeat the level we already reported, these are spikes that were over before the ISR read the pin
+bool IRAM_ATTR RinnaiSignalDecoder::isGlitchFromISR(byte newLevel)
+{
+	if (newLevel == lastLevel)
+	{
+		glitchCounter++;
+		return true;
+	}
+	lastLevel = newLevel;
+	return false;
+}
+
+// the edge held by the ISR, once no glitch can follow it. ticks are used since the cycle counters of the cores differ.
+bool RinnaiSignalDecoder::takeHeldEdge(PulseQueueItem &pulse)
+{
+	bool taken = false;
+	portENTER_CRITICAL(&heldEdgeMux);
+	if (heldEdgeSet && uxQueueMessagesWaiting(pulseQueue) == 0 && xTaskGetTickCount() - heldEdgeTick >= HELD_EDGE_MIN_TICKS)
+	{
+		pulse = heldEdge;
+		heldEdgeSet = false;
+		taken = true;
+	}
+	portEXIT_CRITICAL(&heldEdgeMux);
+	return taken;
+}
+
+// wait for the next edge that passed the glitch filter
+// while the filter is on the ISR notifies this task on every edge, as an edge it holds does not reach the queue
+// the task sleeps until then and only wakes every tick while an edge is held, the last edge of a packet is decoded once it is taken
+BaseType_t RinnaiSignalDecoder::receiveEdge(PulseQueueItem &pulse)
+{
+	for (;;)
+	{
+		if (xQueueReceive(pulseQueue, &pulse, 0) == pdTRUE || takeHeldEdge(pulse))
+		{
+			return pdTRUE;
+		}
+		if (glitchFilterCycles == 0 && !heldEdgeSet)
+		{
+			return xQueueReceive(pulseQueue, &pulse, portMAX_DELAY);
 		}
+		ulTaskNotifyTake(pdTRUE, heldEdgeSet ? 1 : portMAX_DELAY);
+	}
+}
+
+void RinnaiSignalDecoder::setGlitchFilter(unsigned int minPulseUs)
+{
+	if (minPulseUs > GLITCH_FILTER_MAX_US)
+	{
+		minPulseUs = GLITCH_FILTER_MAX_US;
+	}
+	glitchFilterCycles = microsecondsToClockCycles(minPulseUs);
+	pulseClassifier.setGlitchFilter(minPulseUs); // for the synthetic noise, which is added after the ISR
+	if (bitTask != NULL) // it may wait on a notification that the ISR no longer sends
+	{
+		xTaskNotifyGive(bitTask);
 	}
 }
 
+// copy an edge to the tap as the cycle count with bit 1 holding the tap id and bit 0 the level
+void RinnaiSignalDecoder::tapEdge(const PulseQueueItem &pulse)
+{
+	RingbufHandle_t tap = edgeTap; // can be cleared by another task at any time
+	if (tap == NULL)
+	{
+		return;
+	}
+	uint32_t word = (pulse.value & ~EDGE_TAP_ID_MASK & ~PULSE_LEVEL_MASK) | (edgeTapId ? EDGE_TAP_ID_MASK : 0) | (pulse.value & PULSE_LEVEL_MASK);
+	if (xRingbufferSend(tap, &word, sizeof(word), 0) != pdTRUE)
+	{
+		edgeTapOverflowCounter++;
+	}
+}
+
+// stream raw edges to a ring buffer, NULL to stop
+void RinnaiSignalDecoder::setEdgeTap(RingbufHandle_t tap, byte tapId)
+{
+	edgeTapId = tapId;
+	edgeTap = tap;
+}
+
+// pull the next pulse from the pulse queue, applying synthetic noise if it was requested
+BaseType_t RinnaiSignalDecoder::receivePulse(PulseQueueItem &pulse)
+{
+	if (noiseInjector.takeInjectedPulse(pulse))
+	{
+		return pdTRUE;
+	}
+	BaseType_t ret;
+	do
+	{
+		ret = receiveEdge(pulse);
+		if (ret == pdTRUE && edgeTap != NULL) // edges as received, before any synthetic noise
+		{
+			tapEdge(pulse);
+		}
+	} while (ret == pdTRUE && noiseInjector.isMissed());
+	if (ret == pdTRUE)
+	{
+		noiseInjector.apply(pulse);
+	}
+	return ret;
+}
+
+// set the synthetic noise level, also restarts the robustness statistics so they reflect the new level
+void RinnaiSignalDecoder::setNoiseInjection(const NoiseInjection &noise)
+{
+	noiseInjector.configure(noise);
+	pulseClassifier.clearFrameSlotCounter();
+	packetAssembler.clearCounters();
+}
+
+// share of packets, out of those that were sent on the bus, that we failed to decode
+unsigned int RinnaiSignalDecoder::getFrameLossPerMille()
+{
+	unsigned int frameSlotCounter = getFrameSlotCounter();
+	unsigned int validPacketCounter = getValidPacketCounter();
+	if (frameSlotCounter == 0 || validPacketCounter >= frameSlotCounter)
+	{
+		return 0;
+	}
+	return (frameSlotCounter - validPacketCounter) * 1000 / frameSlotCounter;
+}
+
+// assemble symbols into packets
 void RinnaiSignalDecoder::packetTaskHandler()
 {
 	logStream().println("packetTaskHandler started");
 	BitQueueItem bit; // we read these, process and push data to the packet queue
 
-	PacketQueueItem packet; // current state
-	packet.bitsPresent = 0;
-	packet.startCycle = 0;
-	packet.startMicros = 0;
-	packet.startMillis = 0;
-	packet.validPre = false;
-	packet.validChecksum = false;
-	packet.validParity = false;
-	memset(packet.data, 0, sizeof(packet.data));
-
 	for (;;)
 	{
 		BaseType_t ret = xQueueReceive(bitQueue, &bit, portMAX_DELAY); // pdTRUE if an item was successfully received from the queue, otherwise pdFALSE.
 		if (ret != pdTRUE)											   // if can't pull from queue
 		{
 			packetTaskErrorCounter++;
+			continue;
 		}
-		else
+		PacketAssemblerEvent event = packetAssembler.push(bit);
+		PacketQueueItem &packet = packetAssembler.getPacket();
+		if (event == PACKET_ANCHORED)
 		{
-			switch (bit.bit)
-			{
-			case SYM0:
-				// nothing to store, just move forward
-				packet.bitsPresent++;
-				break;
-			case SYM1:
-				// store bit in packet data
-				if (packet.bitsPresent < BITS_IN_PACKET)
-				{
-					packet.data[packet.bitsPresent / 8] |= (1 << (packet.bitsPresent % 8));
-				}
-				packet.bitsPresent++;
-				break;
-			case ERROR:
-			default:
-				packetTaskErrorCounter++;
-			case PRE:
-				// flush current (invalid packet) ?
-				// reset state
-				packet.bitsPresent = 0;
-				packet.startCycle = bit.startCycle;
-				packet.startMicros = micros(); // this is the time of processing the bit queue item and not exact time of the pulse in the ISR. it was accurate to a ms level most of the time.
-				// it is not possible to compensate for the difference using clockCyclesToMicroseconds(xthal_get_ccount() - bit.startCycle) because "xthal_get_ccount" is core specific and this task is not pinned to a specific core.
-				// the difference is about 1ms, though, assuming one of the cores can run this task and we are not "stuck" on high priority tasks. This can be observed using xPortGetCoreID() and the expression above.
-				packet.startMillis = millis(); // millis and micros come from the same 64bit counter (esp_timer_get_time()) but they overflow/wrap differently.
-				packet.validPre = bit.bit == PRE;
-				packet.validChecksum = false;
-				packet.validParity = false;
-				memset(packet.data, 0, sizeof(packet.data));
-			}
-			// see if we completed a packet
-			if (packet.bitsPresent == BITS_IN_PACKET)
-			{
-				// check parity (each data byte has “odd parity bit” as the MSB bit)
-				packet.validParity = true; // be optimistic
-				for (int i = 0; i < BYTES_IN_PACKET - 1; i++)
-				{
-					if (!isOddParity(packet.data[i]))
-					{
-						packet.validParity = false;
-					}
-				}
-				// check checksum (last byte is xor of first 5 bytes)
-				byte checksum = 0;
-				for (int i = 0; i < BYTES_IN_PACKET; i++)
-				{
-					checksum ^= packet.data[i];
-				}
-				packet.validChecksum = checksum == 0;
-				// send
-				BaseType_t ret = xQueueSendToBack(packetQueue, &packet, 0); // no wait
-				if (ret != pdTRUE)
-				{
-					// inc error counter
-					packetTaskErrorCounter++;
-				}
-				// reset state, so if we keep getting bytes then we result in error packets
-				packet.bitsPresent = 0;
-				packet.validPre = false;
-				packet.validChecksum = false;
-				packet.validParity = false;
-				memset(packet.data, 0, sizeof(packet.data));
-			}
+			packet.startMicros = micros(); // this is the time of processing the bit queue item and not exact time of the pulse in the ISR. it was accurate to a ms level most of the time.
+			// it is not possible to compensate for the difference using clockCyclesToMicroseconds(xthal_get_ccount() - bit.startCycle) because "xthal_get_ccount" is core specific and this task is not pinned to a specific core.
+			// the difference is about 1ms, though, assuming one of the cores can run this task and we are not "stuck" on high priority tasks. This can be observed using xPortGetCoreID() and the expression above.
+			packet.startMillis = millis(); // millis and micros come from the same 64bit counter (esp_timer_get_time()) but they overflow/wrap differently.
+			continue;
+		}
+		if (event != PACKET_READY)
+		{
+			continue;
+		}
+		if (RinnaiPacketAssembler::isValid(packet) && !packet.recovered)
+		{
+			slotTracker.update(packet.startCycle);
+		}
+		// send
+		ret = xQueueSendToBack(packetQueue, &packet, 0); // no wait
+		if (ret != pdTRUE)
+		{
+			// inc error counter
+			packetTaskErrorCounter++;
 		}
 	}
 }
 
-bool RinnaiSignalDecoder::isOddParity(byte b)
-{
-	// https://stackoverflow.com/questions/21617970/how-to-check-if-value-has-even-parity-of-bits-or-odd
-	b ^= b >> 4;
-	b ^= b >> 2;
-	b ^= b >> 1;
-	return b & 1;
-}
-
 // wait for signals to override then flush previously set bytes
 void RinnaiSignalDecoder::overrideTaskHandler()
 {
 	logStream().println("overrideTaskHandler started");
 	for (;;)
 	{
+		if (emulationEnabled)
+		{
+			emulateSlot();
+			continue;
+		}
+		if (overridePacketSet && slotTracker.isLocked())
+		{
+			overrideSlot();
+			continue;
+		}
 		/* Wait to be notified that we need to do work. Note the first
 		parameter is pdTRUE, which has the effect of clearing the task's notification
 		value back to 0, making the notification value act like a binary (rather than
-		a counting) semaphore.  */
-		uint32_t ulNotificationValue = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		a counting) semaphore.
+		The ISR notifies once it started an override, setOverridePacket to arm the next slot.  */
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(EMULATION_POLL_MS));
 
-		if (ulNotificationValue == 1)
+		if (isOverriding)
 		{
-			// we got a notification, write data
+			// the ISR saw the first edge of the packet, write data
 			writeOverridePacket();
+			overrideCounter++;
 			delayMicroseconds(PERIOD_BETWEEN_TX_PACKETS_MARGIN * 2); // delay to make sure we cover the original changes
 			// we finished, clear state
 			overridePacketSet = false; // this makes sure a packet is only sent once
@@ -427,6 +638,106 @@ void RinnaiSignalDecoder::overrideTaskHandler()
 	}
 }
 
+// send the override packet on the predicted slot of the panel instead of reacting to its first edge
+// the output is taken just ahead of the slot, so none of the panel's packet gets through and ours starts on time
+void RinnaiSignalDecoder::overrideSlot()
+{
+	unsigned int now = xthal_get_ccount();
+	unsigned int slotCycle = slotTracker.predictNextStart(now);
+	// sleep most of the way, then check that the slot still stands
+	unsigned int waitMs = clockCyclesToMicroseconds(slotCycle - now) / 1000;
+	if (waitMs > EMULATION_SPIN_MS)
+	{
+		vTaskDelay(pdMS_TO_TICKS(waitMs - EMULATION_SPIN_MS));
+		now = xthal_get_ccount();
+		slotCycle = slotTracker.predictNextStart(now);
+		if (clockCyclesToMicroseconds(slotCycle - now) / 1000 >= OVERRIDE_ARM_MAX_MS) // the prediction moved on, start over
+		{
+			return;
+		}
+	}
+	portENTER_CRITICAL(&overrideMux);
+	bool claimed = overridePacketSet && !isOverriding && slotTracker.isLocked() && !emulationEnabled;
+	if (claimed)
+	{
+		isOverriding = true; // stop mirroring, the panel's packet is due
+	}
+	portEXIT_CRITICAL(&overrideMux);
+	if (!claimed) // cancelled, lost the lock or the ISR started it
+	{
+		return;
+	}
+	while ((int)(slotCycle - xthal_get_ccount()) > 0)
+		;
+	writeOverridePacket();
+	overrideCounter++;
+	delayMicroseconds(PERIOD_BETWEEN_TX_PACKETS_MARGIN * 2); // delay to make sure we cover the original changes
+	overridePacketSet = false; // this makes sure a packet is only sent once
+	isOverriding = false;
+}
+
+// act as the control panel, send a packet on the next slot without waiting for the panel
+// the slots follow the real panel while we can see it and keep its cycle going when it is gone
+void RinnaiSignalDecoder::emulateSlot()
+{
+	unsigned int now = xthal_get_ccount();
+	unsigned int periodCycles = slotTracker.getPeriodCycles();
+	if (periodCycles == 0)
+	{
+		periodCycles = microsecondsToClockCycles(EMULATION_DEFAULT_PERIOD_US);
+	}
+	nextEmulationSlotCycle = slotTracker.scheduleSlot(now, nextEmulationSlotCycle, periodCycles);
+	int waitCycles = (int)(nextEmulationSlotCycle - now);
+	// sleep most of the way, then spin for an exact start
+	unsigned int waitMs = clockCyclesToMicroseconds((unsigned int)waitCycles) / 1000;
+	if (waitMs > EMULATION_SPIN_MS)
+	{
+		vTaskDelay(pdMS_TO_TICKS(waitMs - EMULATION_SPIN_MS));
+	}
+	if (!emulationEnabled) // turned off while we waited
+	{
+		return;
+	}
+	while ((int)(nextEmulationSlotCycle - xthal_get_ccount()) > 0)
+		;
+	// send a pending override or just the idle packet
+	isOverriding = true;
+	if (overridePacketSet)
+	{
+		writeOverridePacket();
+		overrideCounter++;
+		overridePacketSet = false;
+	}
+	else
+	{
+		writePacket(proxyOutPin, emulationPacket, BYTES_IN_PACKET, invertOut);
+	}
+	emulationPacketCounter++;
+	isOverriding = false;
+	nextEmulationSlotCycle += periodCycles;
+}
+
+// turn panel emulation on with the given idle packet, or off when data is NULL
+bool RinnaiSignalDecoder::setEmulationPacket(const byte *data, int length)
+{
+	if (data == NULL)
+	{
+		emulationEnabled = false;
+		return true;
+	}
+	if (length != BYTES_IN_PACKET || proxyOutPin == INVALID_PIN)
+	{
+		return false;
+	}
+	// wait for high priority override task to complete
+	while (isOverriding)
+		;
+
+	memcpy(emulationPacket, data, length);
+	emulationEnabled = true;
+	return true;
+}
+
 void RinnaiSignalDecoder::writeOverridePacket()
 {
 	writePacket(proxyOutPin, overridePacket, BYTES_IN_PACKET, invertOut);
@@ -482,5 +793,19 @@ bool RinnaiSignalDecoder::setOverridePacket(const byte *data, int length)
 
 	memcpy(overridePacket, data, length);
 	overridePacketSet = true; // turn on flag
+	if (overrideTask != NULL) // arm the next slot right away
+	{
+		xTaskNotifyGive(overrideTask);
+	}
 	return true;
 }
+
+// drop an override packet that wasn't sent yet
+void RinnaiSignalDecoder::cancelOverridePacket()
+{
+	// wait for high priority override task to complete
+	while (isOverriding)
+		;
+
+	overridePacketSet = false;
+}
@@ -0,0 +1,151 @@
+#include "RinnaiSlotTracker.hpp"
+
+// cycles of 200ms and 250ms were observed
+const unsigned int SLOT_PERIOD_MIN_US = 150000;
+const unsigned int SLOT_PERIOD_MAX_US = 300000;
+const unsigned int SLOT_TOLERANCE_US = 500;	 // a packet starting this close to the prediction is a hit. less than the "pre" pulse so only the first edge can match.
+const unsigned int SLOT_RESYNC_US = 20000;	 // a packet this far from the prediction means we lost track
+const unsigned int MAX_MISSED_SLOTS = 4;	 // packets we may fail to decode and still keep the phase
+const byte SLOT_LOCK_COUNT = 4;				 // consecutive hits before the prediction is used
+const int PERIOD_GAIN_SHIFT = 3;			 // correct the period by 1/8 of the error on every packet
+const int ERROR_AVERAGE_SHIFT = 3;
+
+// feed the start of a valid packet
+void RinnaiSlotTracker::update(unsigned int startCycle)
+{
+	if (!hasLastStart)
+	{
+		reset(startCycle);
+		return;
+	}
+	unsigned int delta = startCycle - lastStartCycle;
+	// first estimate of the period
+	if (periodCycles == 0)
+	{
+		unsigned int deltaUs = clockCyclesToMicroseconds(delta);
+		publish(startCycle, deltaUs > SLOT_PERIOD_MIN_US && deltaUs < SLOT_PERIOD_MAX_US ? delta : 0, false);
+		return;
+	}
+	// how many slots passed, more than one if we failed to decode some packets
+	unsigned int slots = (delta + periodCycles / 2) / periodCycles;
+	if (slots == 0 || slots > MAX_MISSED_SLOTS)
+	{
+		reset(startCycle);
+		return;
+	}
+	int error = (int)(delta - slots * periodCycles);
+	unsigned int absError = error < 0 ? -error : error;
+	if (absError > microsecondsToClockCycles(SLOT_RESYNC_US))
+	{
+		reset(startCycle);
+		return;
+	}
+	// statistics
+	predictionCounter++;
+	if (absError < microsecondsToClockCycles(SLOT_TOLERANCE_US))
+	{
+		hitCounter++;
+		if (lockCounter < SLOT_LOCK_COUNT)
+		{
+			lockCounter++;
+		}
+	}
+	else
+	{
+		lockCounter = 0;
+	}
+	meanErrorCycles += ((int)absError - (int)meanErrorCycles) >> ERROR_AVERAGE_SHIFT;
+	// follow period and phase
+	publish(startCycle, periodCycles + error / (int)(slots << PERIOD_GAIN_SHIFT), lockCounter >= SLOT_LOCK_COUNT);
+}
+
+void RinnaiSlotTracker::reset(unsigned int startCycle)
+{
+	lockCounter = 0;
+	publish(startCycle, 0, false);
+	hasLastStart = true;
+}
+
+// readers on the other core must never see a new period with an old phase, or a lock without a period
+void RinnaiSlotTracker::publish(unsigned int startCycle, unsigned int period, bool isLocked)
+{
+	portENTER_CRITICAL(&slotMux);
+	lastStartCycle = startCycle;
+	periodCycles = period;
+	locked = isLocked && period != 0;
+	portEXIT_CRITICAL(&slotMux);
+}
+
+// is this edge the start of a predicted packet
+bool IRAM_ATTR RinnaiSlotTracker::isSlotStart(unsigned int cycle)
+{
+	portENTER_CRITICAL_ISR(&slotMux);
+	bool isLocked = locked;
+	unsigned int start = lastStartCycle;
+	unsigned int period = periodCycles;
+	portEXIT_CRITICAL_ISR(&slotMux);
+	if (!isLocked || period == 0)
+	{
+		return false;
+	}
+	unsigned int delta = cycle - start;
+	unsigned int slots = (delta + period / 2) / period;
+	if (slots == 0)
+	{
+		return false;
+	}
+	int error = (int)(delta - slots * period);
+	unsigned int absError = error < 0 ? -error : error;
+	return absError < microsecondsToClockCycles(SLOT_TOLERANCE_US);
+}
+
+// when will the first packet after the given time start
+unsigned int RinnaiSlotTracker::predictNextStart(unsigned int cycle)
+{
+	portENTER_CRITICAL(&slotMux);
+	unsigned int start = lastStartCycle;
+	unsigned int period = periodCycles;
+	portEXIT_CRITICAL(&slotMux);
+	if (period == 0)
+	{
+		return cycle;
+	}
+	unsigned int delta = cycle - start;
+	return start + (delta / period + 1) * period;
+}
+
+// when to send our own packet, on the predicted slot while locked, else on the planned one
+// a planned start that was missed or is more than a period away starts a new cycle
+unsigned int RinnaiSlotTracker::scheduleSlot(unsigned int cycle, unsigned int plannedStart, unsigned int periodCycles)
+{
+	if (locked)
+	{
+		plannedStart = predictNextStart(cycle);
+	}
+	int waitCycles = (int)(plannedStart - cycle);
+	if (waitCycles <= 0 || waitCycles > (int)periodCycles)
+	{
+		return cycle + periodCycles;
+	}
+	return plannedStart;
+}
+
+unsigned int RinnaiSlotTracker::getPeriodMicros()
+{
+	return clockCyclesToMicroseconds(periodCycles);
+}
+
+unsigned int RinnaiSlotTracker::getMeanErrorMicros()
+{
+	return clockCyclesToMicroseconds(meanErrorCycles);
+}
+
+// share of packets that started where we predicted them to
+unsigned int RinnaiSlotTracker::getHitPerMille()
+{
+	if (predictionCounter == 0)
+	{
+		return 0;
+	}
+	return (unsigned long long)hitCounter * 1000 / predictionCounter;
+}
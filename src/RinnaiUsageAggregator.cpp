@@ -0,0 +1,92 @@
+#include "RinnaiUsageAggregator.hpp"
+
+const unsigned long MAX_PACKET_GAP_MS = 1000; // beyond this we lost the bus, do not extrapolate
+
+// account for the time since the previous heater packet, then take the state of this one
+void RinnaiUsageAggregator::update(const RinnaiHeaterPacket &packet, unsigned long millis)
+{
+	if (!hasLast)
+	{
+		minute.current.startMillis = millis;
+		hour.current.startMillis = millis;
+	}
+	else
+	{
+		bool covered = millis - lastMillis <= MAX_PACKET_GAP_MS;
+		advance(minute, MINUTE_MS, millis, covered);
+		advance(hour, HOUR_MS, millis, covered);
+		// an ignition belongs to the period of the packet that shows it
+		if (packet.inUse && !last.inUse)
+		{
+			minute.current.ignitions++;
+			hour.current.ignitions++;
+		}
+	}
+	last = packet;
+	lastMillis = millis;
+	hasLast = true;
+}
+
+// finished aggregates, each is returned once. one that is not taken is kept until the next period of its kind closes
+bool RinnaiUsageAggregator::takeMinute(Aggregate &aggregate)
+{
+	if (!minute.ready)
+	{
+		return false;
+	}
+	aggregate = minute.done;
+	minute.ready = false;
+	return true;
+}
+
+bool RinnaiUsageAggregator::takeHour(Aggregate &aggregate)
+{
+	if (!hour.ready)
+	{
+		return false;
+	}
+	aggregate = hour.done;
+	hour.ready = false;
+	return true;
+}
+
+void RinnaiUsageAggregator::accumulate(Period &period, unsigned long deltaMillis)
+{
+	period.current.coveredMillis += deltaMillis;
+	period.current.setpointMillis += last.temperatureCelsius * deltaMillis;
+	if (last.on)
+	{
+		period.current.onMillis += deltaMillis;
+	}
+	if (last.inUse)
+	{
+		period.current.inUseMillis += deltaMillis;
+	}
+}
+
+// account for the time from the previous packet until millis, if covered, and close the period once its length has passed
+// a packet that spans the end of the period is split there. the next period starts where this one ended unless the bus was gone for longer
+void RinnaiUsageAggregator::advance(Period &period, unsigned long length, unsigned long millis, bool covered)
+{
+	if (millis - period.current.startMillis < length)
+	{
+		if (covered)
+		{
+			accumulate(period, millis - lastMillis);
+		}
+		return;
+	}
+	unsigned long end = period.current.startMillis + length;
+	if (covered)
+	{
+		accumulate(period, end - lastMillis);
+	}
+	period.done = period.current;
+	period.ready = true;
+	period.current = {};
+	period.current.startMillis = millis - end < length ? end : millis;
+	if (covered)
+	{
+		accumulate(period, millis - period.current.startMillis);
+	}
+}
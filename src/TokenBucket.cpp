@@ -0,0 +1,48 @@
+#include "TokenBucket.hpp"
+
+TokenBucket::TokenBucket(unsigned int capacity, unsigned long intervalMillis)
+	: capacity(capacity), intervalMillis(intervalMillis), tokens(capacity)
+{
+}
+
+// start over full with new settings
+void TokenBucket::configure(unsigned int capacity, unsigned long intervalMillis)
+{
+	this->capacity = capacity;
+	this->intervalMillis = intervalMillis;
+	tokens = capacity;
+	lastRefillMillis = millis();
+}
+
+bool TokenBucket::tryTake(unsigned long nowMillis)
+{
+	if (intervalMillis == 0)
+	{
+		return true;
+	}
+	refill(nowMillis);
+	if (tokens == 0)
+	{
+		return false;
+	}
+	tokens--;
+	return true;
+}
+
+// add a token per whole interval that passed, keeping the remainder for the next one
+void TokenBucket::refill(unsigned long nowMillis)
+{
+	unsigned long elapsed = nowMillis - lastRefillMillis;
+	if (tokens >= capacity)
+	{
+		lastRefillMillis = nowMillis;
+		return;
+	}
+	unsigned long added = elapsed / intervalMillis;
+	if (added == 0)
+	{
+		return;
+	}
+	tokens = added >= capacity - tokens ? capacity : tokens + added;
+	lastRefillMillis += added * intervalMillis;
+}
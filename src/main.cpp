@@ -9,13 +9,13 @@
 #include "LogStream.hpp"
 #include "RinnaiSignalDecoder.hpp"
 #include "RinnaiMQTTGateway.hpp"
+#include "MQTTPublisher.hpp"
+#include "RinnaiEdgeServer.hpp"
 
 // settings managed through a private_config.ini file
 #include "config.hpp"
 
 // hardcoded settings (consider to move to separate config or to the ini)
-// mqtt
-const int MQTT_PACKET_MAX_SIZE = 700; // the config message is rather large, keep enough space
 // wifi manager - // max configuration paramter length
 const int WIFI_CONFIG_PARAM_MAX_LEN = 128;
 // wifi manager - Configuration specific key. The value should be modified if config structure was changed.
@@ -31,16 +31,36 @@ WebServer server(80);
 IotWebConf iotWebConf(HOST_NAME, &dnsServer, &server, WIFI_INITIAL_AP_PASSWORD, WIFI_CONFIG_VERSION);
 WiFiClient net;
 MQTTClient mqttClient(MQTT_PACKET_MAX_SIZE);
+MQTTPublisher mqttPublisher(mqttClient);
+#ifdef RUNTIME_PIN_DECODERS // the ISR with runtime pin and polarity checks, only built to compare its cost with the templated one
 RinnaiSignalDecoder rxDecoder(RX_RINNAI_PIN, INVALID_PIN, RX_INVERT);
 RinnaiSignalDecoder txDecoder(TX_IN_RINNAI_PIN, TX_OUT_RINNAI_PIN, TX_IN_INVERT, TX_OUT_INVERT);
-RinnaiMQTTGateway rinnaiMqttGateway(HA_DEVICE_NAME, rxDecoder, txDecoder, mqttClient, MQTT_TOPIC, TEST_PIN);
+#else
+StaticRinnaiSignalDecoder<RX_RINNAI_PIN, -1, RX_INVERT> rxDecoder;
+StaticRinnaiSignalDecoder<TX_IN_RINNAI_PIN, TX_OUT_RINNAI_PIN, TX_IN_INVERT, TX_OUT_INVERT> txDecoder;
+#endif
+RinnaiMQTTGateway rinnaiMqttGateway(HA_DEVICE_NAME, rxDecoder, txDecoder, mqttClient, mqttPublisher, MQTT_TOPIC, TEST_PIN);
+RinnaiEdgeServer edgeServer(rxDecoder, txDecoder);
 RemoteDebug remoteDebug;
 
 // state
 boolean needReset = false;
 boolean needOTAConnect = false;
 boolean needMqttConnect = false;
+boolean needMqttReconfigure = false;
 unsigned long lastMqttConnectionAttempt = 0;
+unsigned long mqttReconfigureMillis = 0; // when the client was taken down to apply new settings, 0 if not
+boolean mqttConnectedOnce = false;
+
+// configuration in effect, to tell which changes can be applied without a reboot
+String appliedWifiSsid;
+String appliedWifiPassword;
+String appliedThingName;
+String appliedApPassword;
+String appliedApTimeout;
+String appliedMqttServer;
+String appliedMqttUserName;
+String appliedMqttUserPassword;
 
 char mqttServerValue[WIFI_CONFIG_PARAM_MAX_LEN];
 char mqttUserNameValue[WIFI_CONFIG_PARAM_MAX_LEN];
@@ -60,6 +80,8 @@ void setupMqtt();
 void connectWifi(const char *ssid, const char *password);
 void wifiConnected();
 void configSaved();
+void snapshotConfig();
+void reconfigureMqtt();
 boolean formValidator(iotwebconf::WebRequestWrapper* webRequestWrapper);
 boolean connectMqtt();
 boolean connectMqttOptions();
@@ -76,7 +98,17 @@ void setup()
 	logStream().printf("Finished setting up rx decoder, %d\n", retRx);
 	bool retTx = txDecoder.setup();
 	logStream().printf("Finished setting up tx decoder, %d\n", retTx);
-	if (!retRx || !retTx)
+	if (ISR_BENCHMARK_PIN != -1)
+	{
+		RinnaiSignalDecoder::setupISRBenchmark(ISR_BENCHMARK_PIN);
+	}
+	rinnaiMqttGateway.getBootTiming().decodersReadyMillis = millis();
+	rinnaiMqttGateway.setup();
+	bool retPublisher = mqttPublisher.setup();
+	logStream().printf("Finished setting up mqtt publisher, %d\n", retPublisher);
+	bool retEdgeServer = edgeServer.setup();
+	logStream().printf("Finished setting up edge server, %d\n", retEdgeServer);
+	if (!retRx || !retTx || !retPublisher)
 	{
 		for (;;)
 			; // hang further execution
@@ -119,6 +151,15 @@ void setupWifiManager()
 	// -- Set up required URL handlers on the web server.
 	server.on("/", handleRoot);
 	server.on("/config", [] { iotWebConf.handleConfig(); });
+	server.on("/capture", [] {
+		// same credentials as the config page
+		if (!server.authenticate(IOTWEBCONF_ADMIN_USER_NAME, iotWebConf.getApPasswordParameter()->valueBuffer))
+		{
+			server.requestAuthentication();
+			return;
+		}
+		rinnaiMqttGateway.getCaptureLog().download(server);
+	});
 	server.onNotFound([]() { iotWebConf.handleNotFound(); });
 }
 
@@ -207,14 +248,19 @@ void loop()
 	}
 	// RemoteDebug handle
 	remoteDebug.handle();
-	// MQTT loop
-	mqttClient.loop();
+	// MQTT loop, skip a turn if the publisher is sending so we do not wait on the network
+	if (mqttPublisher.tryLockClient())
+	{
+		mqttClient.loop();
+		mqttPublisher.unlockClient();
+	}
 
 	// need to setup OTA after wifi connection
 	if (needOTAConnect)
 	{
 		setupRemoteDebug();
 		setupOTA();
+		edgeServer.begin();
 		needOTAConnect = false;
 	}
 
@@ -232,6 +278,13 @@ void loop()
 		connectMqtt();
 	}
 
+	// apply mqtt settings without a reboot
+	if (needMqttReconfigure)
+	{
+		reconfigureMqtt();
+		needMqttReconfigure = false;
+	}
+
 	// need to reset after config change
 	if (needReset)
 	{
@@ -240,6 +293,9 @@ void loop()
 		ESP.restart();
 	}
 
+	// raw edge stream
+	edgeServer.loop();
+
 	// mqtt and rinnai business logic
 	rinnaiMqttGateway.loop();
 	// see if others want to do some work
@@ -259,7 +315,8 @@ void handleRoot()
 	}
 	String s = "<!DOCTYPE html><html lang=\"en\"><head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1, user-scalable=no\"/>";
 	s += "<title>Rinnai Wifi</title></head><body>";
-	s += "Go to <a href='config'>configure page</a> to change settings.";
+	s += "Go to <a href='config'>configure page</a> to change settings.<br/>";
+	s += "Download the <a href='capture'>packet capture</a>.";
 	s += "</body></html>\n";
 
 	server.send(200, "text/html", s);
@@ -283,12 +340,52 @@ void wifiConnected()
 {
 	needOTAConnect = true;
 	needMqttConnect = true;
+	snapshotConfig();
+	if (rinnaiMqttGateway.getBootTiming().wifiConnectedMillis == 0)
+	{
+		rinnaiMqttGateway.getBootTiming().wifiConnectedMillis = millis();
+	}
 }
 
+// mqtt settings are applied live so the decoders keep running, any other change needs a reboot
 void configSaved()
 {
 	logStream().println("Configuration was updated.");
-	needReset = true;
+	if (appliedWifiSsid != iotWebConf.getWifiSsidParameter()->valueBuffer || appliedWifiPassword != iotWebConf.getWifiPasswordParameter()->valueBuffer || appliedThingName != iotWebConf.getThingName() ||
+		appliedApPassword != iotWebConf.getApPasswordParameter()->valueBuffer || appliedApTimeout != iotWebConf.getApTimeoutParameter()->valueBuffer)
+	{
+		needReset = true;
+	}
+	else if (appliedMqttServer != mqttServerValue || appliedMqttUserName != mqttUserNameValue || appliedMqttUserPassword != mqttUserPasswordValue)
+	{
+		needMqttReconfigure = true;
+	}
+}
+
+void snapshotConfig()
+{
+	appliedWifiSsid = iotWebConf.getWifiSsidParameter()->valueBuffer;
+	appliedWifiPassword = iotWebConf.getWifiPasswordParameter()->valueBuffer;
+	appliedThingName = iotWebConf.getThingName();
+	appliedApPassword = iotWebConf.getApPasswordParameter()->valueBuffer;
+	appliedApTimeout = iotWebConf.getApTimeoutParameter()->valueBuffer;
+	appliedMqttServer = mqttServerValue;
+	appliedMqttUserName = mqttUserNameValue;
+	appliedMqttUserPassword = mqttUserPasswordValue;
+}
+
+// take down only the mqtt client and connect again with the new settings
+void reconfigureMqtt()
+{
+	logStream().println("Applying new MQTT settings");
+	mqttPublisher.lockClient();
+	mqttClient.disconnect();
+	mqttClient.setHost(mqttServerValue); // use default port = 1883
+	mqttPublisher.unlockClient();
+	snapshotConfig();
+	mqttReconfigureMillis = millis();
+	lastMqttConnectionAttempt = 0;
+	needMqttConnect = true;
 }
 
 boolean formValidator(iotwebconf::WebRequestWrapper* webRequestWrapper)
@@ -315,14 +412,29 @@ boolean connectMqtt()
 		return false;
 	}
 	logStream().println("Connecting to MQTT server...");
+	mqttPublisher.lockClient();
 	if (!connectMqttOptions())
 	{
+		mqttPublisher.unlockClient();
 		lastMqttConnectionAttempt = now;
 		return false;
 	}
 	logStream().println("Connected!");
+	// downtime of a live reconfiguration, to compare with the time it takes to get here after a reboot
+	if (mqttReconfigureMillis)
+	{
+		logStream().printf("MQTT reconfigured in %lu ms\n", millis() - mqttReconfigureMillis);
+		mqttReconfigureMillis = 0;
+	}
+	if (!mqttConnectedOnce) // also if the settings were changed before the first connection
+	{
+		logStream().printf("MQTT connected %lu ms after boot\n", millis());
+		rinnaiMqttGateway.getBootTiming().mqttConnectedMillis = millis();
+	}
+	mqttConnectedOnce = true;
 
-	rinnaiMqttGateway.onMqttConnected();
+	rinnaiMqttGateway.onMqttConnected(); // subscribes with the client lock held
+	mqttPublisher.unlockClient();
 	return true;
 }
 
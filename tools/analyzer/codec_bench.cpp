@@ -0,0 +1,443 @@
+// measures the protocol codec and packet assembly paths of the firmware, in ns and heap allocations per operation
+// compares the results with a baseline file and fails on a regression, so every optimization has a number to beat
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "RinnaiBitActivity.hpp"
+#include "RinnaiPacketAssembler.hpp"
+#include "RinnaiPacketCensus.hpp"
+#include "RinnaiProtocolDecoder.hpp"
+#include "RinnaiUsageAggregator.hpp"
+
+thread_local uint32_t hostCpuFrequencyMhz = 240;
+
+const int PACKETS = 64; // inputs cycled through, so no call sees the same packet twice in a row
+const int ROUNDS = 5; // the fastest round is reported, the others absorb scheduling noise
+const unsigned long OPS_PER_ROUND = 2000000;
+const double DEFAULT_TOLERANCE_PERCENT = 25;
+const double MIN_SLACK_NS = 1; // a few ns ops would otherwise fail on timer noise alone
+const int STATE_JSON_SIZE = 1024; // the research profile
+const unsigned long HEATER_PERIOD_MS = 200;
+
+// every heap allocation of the process, the firmware paths should not need any
+static unsigned long allocations = 0;
+
+void *operator new(size_t size)
+{
+	allocations++;
+	void *p = malloc(size ? size : 1);
+	if (p == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+// keeps a result alive without costing more than a register move
+template <typename T>
+static void keep(const T &value)
+{
+	asm volatile("" : : "g"(&value) : "memory");
+}
+
+struct BenchResult
+{
+	std::string name;
+	double nsPerOp;
+	double allocsPerOp;
+};
+
+// test packets are built by hand, the checksum helper of the decoder is private
+static void setParityAndChecksum(byte *data)
+{
+	byte checksum = 0;
+	for (int i = 0; i < RinnaiProtocolDecoder::BYTES_IN_PACKET - 1; i++)
+	{
+		data[i] &= 0x7f;
+		data[i] |= __builtin_parity(data[i]) ? 0x00 : 0x80;
+		checksum ^= data[i];
+	}
+	data[RinnaiProtocolDecoder::BYTES_IN_PACKET - 1] = checksum;
+}
+
+static void makeHeaterPacket(byte *data, int i)
+{
+	data[0] = 0x07 | ((i & 0x7) << 4);
+	data[1] = i & 1 ? 0x40 : 0x00;
+	data[2] = (i % 15) | (i & 2 ? 0x10 : 0x00);
+	data[3] = i & 0x7f;
+	data[4] = 0x20;
+	setParityAndChecksum(data);
+}
+
+// the heater path of RinnaiMQTTGateway::handleIncomingPacketQueueItem and the state of RinnaiMQTTGateway::loop in the research profile,
+// with the same components and fields. the gateway itself needs the RTOS and the network, keep this in step when it changes
+class GatewayModel
+{
+public:
+	bool handleHeaterPacket(const PacketQueueItem &item)
+	{
+		lastPacketRepeated = false;
+		if (!(item.validPre || item.recovered) || !item.validParity || !item.validChecksum)
+		{
+			return false;
+		}
+		census.record(item.data, true, item.startMillis);
+		RinnaiPacketSource source;
+		if (heaterPacketCounter > 0 && memcmp(item.data, lastHeaterPacketBytes, RinnaiProtocolDecoder::BYTES_IN_PACKET) == 0)
+		{
+			lastPacketRepeated = true;
+			source = HEATER;
+		}
+		else
+		{
+			source = RinnaiProtocolDecoder::getPacketSource(item.data, RinnaiProtocolDecoder::BYTES_IN_PACKET);
+		}
+		if (source != HEATER)
+		{
+			return false;
+		}
+		if (!lastPacketRepeated)
+		{
+			RinnaiHeaterPacket packet;
+			if (!RinnaiProtocolDecoder::decodeHeaterPacket(item.data, packet))
+			{
+				return false;
+			}
+			if (heaterPacketCounter > 0)
+			{
+				byte events = (packet.on != lastHeaterPacketParsed.on) |
+							  (packet.inUse != lastHeaterPacketParsed.inUse) << 1 |
+							  (packet.temperatureCelsius != lastHeaterPacketParsed.temperatureCelsius) << 2 |
+							  (packet.activeId != lastHeaterPacketParsed.activeId) << 3;
+				bitActivity.update(RinnaiBitActivity::HEATER_TRACK, lastHeaterPacketBytes, item.data, events);
+			}
+			memcpy(&lastHeaterPacketParsed, &packet, sizeof(RinnaiHeaterPacket));
+			memcpy(lastHeaterPacketBytes, item.data, RinnaiProtocolDecoder::BYTES_IN_PACKET);
+		}
+		if (heaterPacketCounter > 0)
+		{
+			lastHeaterPacketDeltaMillis = item.startMillis - lastHeaterPacketMillis;
+		}
+		heaterPacketCounter++;
+		lastHeaterPacketMillis = item.startMillis;
+		usage.update(lastHeaterPacketParsed, item.startMillis);
+		return true;
+	}
+
+	// the key fields are rendered in every loop, the others only when the state is sent
+	void renderState(DynamicJsonDocument &doc, bool keyFields)
+	{
+		if (keyFields)
+		{
+			doc["ip"] = String("192.168.1.50");
+			doc["testPin"] = "OFF";
+			doc["enableTemperatureSync"] = true;
+			doc["currentTemperature"] = (int)lastHeaterPacketParsed.temperatureCelsius;
+			doc["targetTemperature"] = 40;
+			doc["mode"] = lastHeaterPacketParsed.on ? "heat" : "off";
+			doc["action"] = lastHeaterPacketParsed.inUse && lastHeaterPacketParsed.on ? "heating" : (lastHeaterPacketParsed.on ? "idle" : "off");
+			doc["activeId"] = (int)lastHeaterPacketParsed.activeId;
+			doc["heaterBytes"] = RinnaiProtocolDecoder::renderPacket(lastHeaterPacketBytes);
+			doc["startupState"] = (int)lastHeaterPacketParsed.startupState;
+			doc["locControlId"] = 2;
+			doc["locControlBytes"] = RinnaiProtocolDecoder::renderPacket(lastHeaterPacketBytes);
+			return;
+		}
+		doc["rssi"] = -60;
+		const char *counters[] = {"rxFrameLoss", "txFrameLoss", "rxRecovered", "txRecovered", "rxCorrected", "txCorrected", "rxUncorrectable", "txUncorrectable",
+								  "rxGlitches", "txGlitches", "slotHitRate", "slotError", "overrideOk", "overrideRetry", "overrideFail", "modelRollbacks",
+								  "mqttQueue", "mqttCoalesced", "mqttDropped", "stateMerged"};
+		for (const char *counter : counters)
+		{
+			doc[counter] = (unsigned int)heaterPacketCounter;
+		}
+		doc["heaterDelta"] = lastHeaterPacketDeltaMillis;
+		doc["locControlTiming"] = 40L;
+		doc["remControlId"] = 0;
+		doc["remControlBytes"] = RinnaiProtocolDecoder::renderPacket(lastHeaterPacketBytes);
+		doc["remControlTiming"] = 80L;
+	}
+
+	bool lastPacketRepeated = false;
+
+private:
+	byte lastHeaterPacketBytes[RinnaiProtocolDecoder::BYTES_IN_PACKET] = {};
+	RinnaiHeaterPacket lastHeaterPacketParsed = {};
+	int heaterPacketCounter = 0;
+	unsigned long lastHeaterPacketMillis = 0;
+	unsigned long lastHeaterPacketDeltaMillis = 0;
+	RinnaiPacketCensus census;
+	RinnaiBitActivity bitActivity;
+	RinnaiUsageAggregator usage;
+};
+
+template <typename F>
+static BenchResult bench(const char *name, unsigned long ops, F op)
+{
+	BenchResult result = {name, 1e30, 0};
+	for (int round = 0; round < ROUNDS; round++)
+	{
+		unsigned long allocationsBefore = allocations;
+		auto start = std::chrono::steady_clock::now();
+		for (unsigned long i = 0; i < ops; i++)
+		{
+			op(i);
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		result.nsPerOp = std::min(result.nsPerOp, seconds * 1e9 / ops);
+		result.allocsPerOp = (double)(allocations - allocationsBefore) / ops;
+	}
+	return result;
+}
+
+static std::vector<BenchResult> runBenches()
+{
+	byte heater[PACKETS][RinnaiProtocolDecoder::BYTES_IN_PACKET];
+	byte control[PACKETS][RinnaiProtocolDecoder::BYTES_IN_PACKET];
+	for (int i = 0; i < PACKETS; i++)
+	{
+		makeHeaterPacket(heater[i], i);
+		RinnaiProtocolDecoder::buildControlPacket(control[i], i % 3);
+	}
+	// the symbols of the heater packets as the pulse classifier hands them over, preamble first then LSB first
+	std::vector<BitQueueItem> bits;
+	for (int i = 0; i < PACKETS; i++)
+	{
+		bits.push_back({PRE});
+		for (int b = 0; b < RinnaiPacketAssembler::BITS_IN_PACKET; b++)
+		{
+			bits.push_back({(unsigned int)((heater[i][b / 8] >> (b % 8)) & 1 ? SYM1 : SYM0)});
+		}
+	}
+
+	std::vector<BenchResult> results;
+	results.push_back(bench("getPacketSource", OPS_PER_ROUND, [&](unsigned long i) {
+		keep(RinnaiProtocolDecoder::getPacketSource(heater[i % PACKETS], RinnaiProtocolDecoder::BYTES_IN_PACKET));
+	}));
+	results.push_back(bench("decodeHeaterPacket", OPS_PER_ROUND, [&](unsigned long i) {
+		RinnaiHeaterPacket packet;
+		keep(RinnaiProtocolDecoder::decodeHeaterPacket(heater[i % PACKETS], packet));
+		keep(packet);
+	}));
+	results.push_back(bench("decodeControlPacket", OPS_PER_ROUND, [&](unsigned long i) {
+		RinnaiControlPacket packet;
+		keep(RinnaiProtocolDecoder::decodeControlPacket(control[i % PACKETS], packet));
+		keep(packet);
+	}));
+	results.push_back(bench("renderPacket", OPS_PER_ROUND, [&](unsigned long i) {
+		keep(RinnaiProtocolDecoder::renderPacket(heater[i % PACKETS]));
+	}));
+	results.push_back(bench("buildOverridePacket", OPS_PER_ROUND, [&](unsigned long i) {
+		byte data[RinnaiProtocolDecoder::BYTES_IN_PACKET];
+		RinnaiProtocolDecoder::buildControlPacket(data, i % 3);
+		RinnaiProtocolDecoder::setTemperatureUpPressed(data);
+		keep(data);
+	}));
+	// a packet is handed to the gateway per PACKET_READY, report the cost per packet
+	RinnaiPacketAssembler assembler;
+	unsigned long bitsPerPacket = RinnaiPacketAssembler::BITS_IN_PACKET + 1;
+	BenchResult assembly = bench("assemblePacket", OPS_PER_ROUND / 10 * bitsPerPacket, [&](unsigned long i) {
+		if (assembler.push(bits[i % bits.size()]) == PACKET_READY)
+		{
+			keep(assembler.getPacket());
+		}
+	});
+	assembly.nsPerOp *= bitsPerPacket;
+	assembly.allocsPerOp *= bitsPerPacket;
+	results.push_back(assembly);
+	if (assembler.getValidPacketCounter() == 0 || assembler.getErrorCounter() != 0)
+	{
+		printf("assemblePacket: the packets were not assembled cleanly, the benchmark input is broken\n");
+		exit(1);
+	}
+
+	// most heater packets repeat the previous one and are matched on their bytes, the others are decoded
+	std::vector<PacketQueueItem> items(PACKETS);
+	for (int i = 0; i < PACKETS; i++)
+	{
+		memcpy(items[i].data, heater[i], RinnaiProtocolDecoder::BYTES_IN_PACKET);
+		items[i].validPre = items[i].validParity = items[i].validChecksum = true;
+	}
+	GatewayModel gateway;
+	unsigned long repeated = 0;
+	results.push_back(bench("handleRepeatedPacket", OPS_PER_ROUND, [&](unsigned long i) {
+		items[0].startMillis = i * HEATER_PERIOD_MS;
+		keep(gateway.handleHeaterPacket(items[0]));
+		repeated += gateway.lastPacketRepeated;
+	}));
+	results.push_back(bench("handleNewPacket", OPS_PER_ROUND, [&](unsigned long i) {
+		PacketQueueItem &item = items[i % PACKETS];
+		item.startMillis = i * HEATER_PERIOD_MS;
+		keep(gateway.handleHeaterPacket(item));
+		repeated += gateway.lastPacketRepeated;
+	}));
+	if (repeated < ROUNDS * (OPS_PER_ROUND - 1) || repeated > ROUNDS * OPS_PER_ROUND)
+	{
+		printf("handlePacket: %lu packets matched as repeated, the benchmark input is broken\n", repeated);
+		exit(1);
+	}
+	results.push_back(bench("renderStateKeyFields", OPS_PER_ROUND / 10, [&](unsigned long) {
+		DynamicJsonDocument doc(STATE_JSON_SIZE);
+		gateway.renderState(doc, true);
+		String payload;
+		serializeJson(doc, payload);
+		keep(payload);
+	}));
+	results.push_back(bench("renderStateFull", OPS_PER_ROUND / 10, [&](unsigned long) {
+		DynamicJsonDocument doc(STATE_JSON_SIZE);
+		gateway.renderState(doc, true);
+		String payload;
+		serializeJson(doc, payload);
+		gateway.renderState(doc, false);
+		String payloadExpanded;
+		serializeJson(doc, payloadExpanded);
+		keep(payloadExpanded);
+		if (doc.overflowed())
+		{
+			printf("renderStateFull: the state does not fit in %d bytes\n", STATE_JSON_SIZE);
+			exit(1);
+		}
+	}));
+	return results;
+}
+
+// "name nsPerOp allocsPerOp" per line, # starts a comment
+static bool readBaseline(const char *path, std::vector<BenchResult> &baseline)
+{
+	FILE *f = fopen(path, "r");
+	if (f == nullptr)
+	{
+		return false;
+	}
+	char line[256];
+	while (fgets(line, sizeof(line), f) != nullptr)
+	{
+		char name[128];
+		BenchResult entry;
+		if (line[0] == '#' || sscanf(line, "%127s %lf %lf", name, &entry.nsPerOp, &entry.allocsPerOp) != 3)
+		{
+			continue;
+		}
+		entry.name = name;
+		baseline.push_back(entry);
+	}
+	fclose(f);
+	return true;
+}
+
+static bool writeBaseline(const char *path, const std::vector<BenchResult> &results)
+{
+	FILE *f = fopen(path, "w");
+	if (f == nullptr)
+	{
+		return false;
+	}
+	fprintf(f, "# codec-bench baseline, ns/op are for the machine that wrote it, rewrite with: ./codec-bench -w %s\n", path);
+	fprintf(f, "# name ns/op allocs/op\n");
+	for (const BenchResult &result : results)
+	{
+		fprintf(f, "%s %.2f %.2f\n", result.name.c_str(), result.nsPerOp, result.allocsPerOp);
+	}
+	fclose(f);
+	return true;
+}
+
+static void usage()
+{
+	printf("usage: codec-bench [-t tolerancePercent] [-w] baseline\n");
+	printf("  compares with the baseline and fails if an operation is slower than the tolerance (default %.0f%%) or allocates more\n", DEFAULT_TOLERANCE_PERCENT);
+	printf("  -w writes the results as the new baseline instead\n");
+}
+
+int main(int argc, char **argv)
+{
+	double tolerancePercent = DEFAULT_TOLERANCE_PERCENT;
+	bool write = false;
+	const char *baselinePath = nullptr;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-t" && i + 1 < argc)
+		{
+			tolerancePercent = atof(argv[++i]);
+		}
+		else if (arg == "-w")
+		{
+			write = true;
+		}
+		else if (arg[0] != '-' && baselinePath == nullptr)
+		{
+			baselinePath = argv[i];
+		}
+		else
+		{
+			usage();
+			return 2;
+		}
+	}
+	if (baselinePath == nullptr)
+	{
+		usage();
+		return 2;
+	}
+
+	std::vector<BenchResult> results = runBenches();
+	if (write)
+	{
+		for (const BenchResult &result : results)
+		{
+			printf("%-20s %8.2f ns/op %6.2f allocs/op\n", result.name.c_str(), result.nsPerOp, result.allocsPerOp);
+		}
+		if (!writeBaseline(baselinePath, results))
+		{
+			printf("Error writing %s\n", baselinePath);
+			return 2;
+		}
+		printf("baseline written to %s\n", baselinePath);
+		return 0;
+	}
+
+	std::vector<BenchResult> baseline;
+	if (!readBaseline(baselinePath, baseline))
+	{
+		printf("Error reading %s, write one with -w\n", baselinePath);
+		return 2;
+	}
+	bool ok = true;
+	for (const BenchResult &result : results)
+	{
+		auto entry = std::find_if(baseline.begin(), baseline.end(), [&](const BenchResult &b) { return b.name == result.name; });
+		if (entry == baseline.end())
+		{
+			printf("%-20s %8.2f ns/op %6.2f allocs/op  no baseline\n", result.name.c_str(), result.nsPerOp, result.allocsPerOp);
+			ok = false;
+			continue;
+		}
+		double maxNs = std::max(entry->nsPerOp * (1 + tolerancePercent / 100), entry->nsPerOp + MIN_SLACK_NS);
+		bool slower = result.nsPerOp > maxNs;
+		bool allocates = result.allocsPerOp > entry->allocsPerOp + 0.005; // the baseline is rounded to 2 digits
+		printf("%-20s %8.2f ns/op %6.2f allocs/op  baseline %8.2f %6.2f  %s\n", result.name.c_str(), result.nsPerOp, result.allocsPerOp, entry->nsPerOp, entry->allocsPerOp,
+			   slower ? "SLOWER" : allocates ? "ALLOCATES MORE" : "ok");
+		ok &= !slower && !allocates;
+	}
+	return ok ? 0 : 1;
+}
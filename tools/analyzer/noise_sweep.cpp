@@ -0,0 +1,289 @@
+// decodes synthetic frames through the firmware noise injector, pulse classifier and packet assembler
+// sweeps each kind of noise and reports the frame loss per level, failing if it rose above the baseline
+
+#include <Arduino.h>
+
+#include <string>
+#include <vector>
+
+#include "RinnaiNoiseInjector.hpp"
+#include "RinnaiPacketAssembler.hpp"
+#include "RinnaiPulseClassifier.hpp"
+
+thread_local uint32_t hostCpuFrequencyMhz = 240;
+
+const int FRAMES = 5000; // per noise level
+const unsigned int FRAME_PERIOD_US = 50000; // a packet takes about 30ms, the rest is the gap
+const unsigned int PRE_HIGH_US = 850;
+const unsigned int SHORT_US = 150; // the short part of a symbol, the long part fills it up to 600us
+const int GLITCH_FILTER_MIN_PULSE_US = 50; // the firmware default
+const unsigned int RANDOM_SEED = 1;
+
+struct NoiseLevel
+{
+	const char *name;
+	NoiseInjection noise;
+};
+
+// each kind of noise on its own, then all of them together
+const NoiseLevel LEVELS[] = {
+	{"clean", {0, 0, 0, 0}},
+	{"jitter-10", {10, 0, 0, 0}},
+	{"jitter-20", {20, 0, 0, 0}},
+	{"jitter-30", {30, 0, 0, 0}},
+	{"jitter-40", {40, 0, 0, 0}},
+	{"jitter-50", {50, 0, 0, 0}}, // each period takes the error of two edges, the symbol windows are +-60us
+	{"glitch-5", {0, 5, 0, 0}},
+	{"glitch-20", {0, 20, 0, 0}},
+	{"glitch-50", {0, 50, 0, 0}},
+	{"drop-1", {0, 0, 1, 0}},
+	{"drop-5", {0, 0, 5, 0}},
+	{"drop-20", {0, 0, 20, 0}},
+	{"invert-1", {0, 0, 0, 1}},
+	{"invert-5", {0, 0, 0, 5}},
+	{"invert-20", {0, 0, 0, 20}},
+	{"mixed-low", {10, 5, 1, 1}},
+	{"mixed-high", {30, 20, 5, 5}},
+};
+
+struct SweepResult
+{
+	std::string name;
+	unsigned int lossPerMille; // frames that were not decoded to the packet that was sent
+	unsigned int wrongPackets; // valid packets that differ from the packet that was sent, e.g. a wrong correction
+	unsigned int corrected;
+	unsigned int uncorrectable;
+	unsigned int deviceLossPerMille; // as the firmware reports it in rxFrameLoss/txFrameLoss
+};
+
+// frame contents are built by hand, the checksum helper of the protocol decoder is private
+static void makePacket(byte *data, int i)
+{
+	byte checksum = 0;
+	data[0] = 0x07 | ((i & 0x7) << 4);
+	data[1] = i & 1 ? 0x40 : 0x00;
+	data[2] = (i % 15) | (i & 2 ? 0x10 : 0x00);
+	data[3] = (i * 7) & 0x7f;
+	data[4] = 0x20;
+	for (int b = 0; b < RinnaiPacketAssembler::BYTES_IN_PACKET - 1; b++)
+	{
+		data[b] |= __builtin_parity(data[b]) ? 0x00 : 0x80;
+		checksum ^= data[b];
+	}
+	data[RinnaiPacketAssembler::BYTES_IN_PACKET - 1] = checksum;
+}
+
+// the edges of one frame as the ISR time stamps them, rise = 1, fall = 0
+static void makeEdges(const byte *data, unsigned int startUs, std::vector<PulseQueueItem> &edges)
+{
+	unsigned int us = startUs;
+	auto edge = [&](byte level) {
+		edges.push_back({(unsigned int)((microsecondsToClockCycles(us) & ~PULSE_LEVEL_MASK) | level)});
+	};
+	edge(1);
+	us += PRE_HIGH_US;
+	edge(0);
+	for (int b = 0; b < RinnaiPacketAssembler::BITS_IN_PACKET; b++)
+	{
+		bool one = (data[b / 8] >> (b % 8)) & 1;
+		us += one ? SHORT_US : RinnaiPulseClassifier::SYMBOL_DURATION_US - SHORT_US;
+		edge(1);
+		us += one ? RinnaiPulseClassifier::SYMBOL_DURATION_US - SHORT_US : SHORT_US;
+		edge(0);
+	}
+}
+
+static SweepResult sweep(const NoiseLevel &level)
+{
+	RinnaiNoiseInjector injector;
+	RinnaiPulseClassifier classifier;
+	RinnaiPacketAssembler assembler;
+	injector.configure(level.noise);
+	classifier.setGlitchFilter(GLITCH_FILTER_MIN_PULSE_US);
+	hostRandom.seed(RANDOM_SEED);
+
+	SweepResult result = {level.name, 0, 0, 0, 0, 0};
+	unsigned int decodedFrames = 0;
+	std::vector<PulseQueueItem> edges;
+	byte data[RinnaiPacketAssembler::BYTES_IN_PACKET];
+	for (int frame = 0; frame < FRAMES; frame++)
+	{
+		makePacket(data, frame);
+		edges.clear();
+		makeEdges(data, (frame + 1) * FRAME_PERIOD_US, edges); // after a gap, like every frame on the bus
+		bool decoded = false;
+		// same order as RinnaiSignalDecoder::receivePulse, injected glitch edges go before the next received edge
+		auto decode = [&](const PulseQueueItem &pulse) {
+			BitQueueItem bit;
+			if (!classifier.push(pulse, bit) || assembler.push(bit) != PACKET_READY)
+			{
+				return;
+			}
+			PacketQueueItem &packet = assembler.getPacket();
+			if (!RinnaiPacketAssembler::isValid(packet))
+			{
+				return;
+			}
+			if (memcmp(packet.data, data, sizeof(data)) != 0)
+			{
+				result.wrongPackets++;
+			}
+			else
+			{
+				decoded = true;
+			}
+		};
+		for (PulseQueueItem pulse : edges)
+		{
+			if (injector.isMissed())
+			{
+				continue;
+			}
+			injector.apply(pulse);
+			decode(pulse);
+			PulseQueueItem injected;
+			while (injector.takeInjectedPulse(injected))
+			{
+				decode(injected);
+			}
+		}
+		decodedFrames += decoded;
+	}
+	result.lossPerMille = (FRAMES - decodedFrames) * 1000 / FRAMES;
+	result.corrected = assembler.getCorrectedPacketCounter();
+	result.uncorrectable = assembler.getUncorrectablePacketCounter();
+	unsigned int frameSlots = classifier.getFrameSlotCounter();
+	unsigned int validPackets = assembler.getValidPacketCounter();
+	result.deviceLossPerMille = frameSlots == 0 || validPackets >= frameSlots ? 0 : (frameSlots - validPackets) * 1000 / frameSlots;
+	return result;
+}
+
+// "name lossPerMille wrongPackets" per line, # starts a comment
+static bool readBaseline(const char *path, std::vector<SweepResult> &baseline)
+{
+	FILE *f = fopen(path, "r");
+	if (f == nullptr)
+	{
+		return false;
+	}
+	char line[256];
+	while (fgets(line, sizeof(line), f) != nullptr)
+	{
+		char name[128];
+		SweepResult entry = {};
+		if (line[0] == '#' || sscanf(line, "%127s %u %u", name, &entry.lossPerMille, &entry.wrongPackets) != 3)
+		{
+			continue;
+		}
+		entry.name = name;
+		baseline.push_back(entry);
+	}
+	fclose(f);
+	return true;
+}
+
+static bool writeBaseline(const char *path, const std::vector<SweepResult> &results)
+{
+	FILE *f = fopen(path, "w");
+	if (f == nullptr)
+	{
+		return false;
+	}
+	fprintf(f, "# noise-sweep baseline, %d frames per level with a fixed seed, rewrite with: ./noise-sweep -w %s\n", FRAMES, path);
+	fprintf(f, "# name lossPerMille wrongPackets\n");
+	for (const SweepResult &result : results)
+	{
+		fprintf(f, "%s %u %u\n", result.name.c_str(), result.lossPerMille, result.wrongPackets);
+	}
+	fclose(f);
+	return true;
+}
+
+static void usage()
+{
+	printf("usage: noise-sweep [-t tolerancePerMille] [-w] baseline\n");
+	printf("  compares with the baseline and fails if the frame loss of a level rose by more than the tolerance (default 0) or more packets were decoded wrong\n");
+	printf("  -w writes the results as the new baseline instead\n");
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int tolerancePerMille = 0;
+	bool write = false;
+	const char *baselinePath = nullptr;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "-t" && i + 1 < argc)
+		{
+			tolerancePerMille = atoi(argv[++i]);
+		}
+		else if (arg == "-w")
+		{
+			write = true;
+		}
+		else if (arg[0] != '-' && baselinePath == nullptr)
+		{
+			baselinePath = argv[i];
+		}
+		else
+		{
+			usage();
+			return 2;
+		}
+	}
+	if (baselinePath == nullptr)
+	{
+		usage();
+		return 2;
+	}
+
+	std::vector<SweepResult> baseline;
+	if (!write && !readBaseline(baselinePath, baseline))
+	{
+		printf("Error reading %s, write one with -w\n", baselinePath);
+		return 2;
+	}
+	std::vector<SweepResult> results;
+	bool ok = true;
+	printf("%-12s %6s %6s %9s %13s %11s\n", "level", "loss", "wrong", "corrected", "uncorrectable", "device loss");
+	for (const NoiseLevel &level : LEVELS)
+	{
+		SweepResult result = sweep(level);
+		results.push_back(result);
+		printf("%-12s %6u %6u %9u %13u %11u", result.name.c_str(), result.lossPerMille, result.wrongPackets, result.corrected, result.uncorrectable, result.deviceLossPerMille);
+		if (write)
+		{
+			printf("\n");
+			continue;
+		}
+		const SweepResult *entry = nullptr;
+		for (const SweepResult &b : baseline)
+		{
+			if (b.name == result.name)
+			{
+				entry = &b;
+			}
+		}
+		if (entry == nullptr)
+		{
+			printf("  no baseline\n");
+			ok = false;
+			continue;
+		}
+		bool worse = result.lossPerMille > entry->lossPerMille + tolerancePerMille || result.wrongPackets > entry->wrongPackets;
+		printf("  baseline %4u %4u  %s\n", entry->lossPerMille, entry->wrongPackets, worse ? "WORSE" : "ok");
+		ok &= !worse;
+	}
+	printf("(loss in frames per 1000, wrong/corrected/uncorrectable in packets out of %d)\n", FRAMES);
+	if (write)
+	{
+		if (!writeBaseline(baselinePath, results))
+		{
+			printf("Error writing %s\n", baselinePath);
+			return 2;
+		}
+		printf("baseline written to %s\n", baselinePath);
+	}
+	return ok ? 0 : 1;
+}
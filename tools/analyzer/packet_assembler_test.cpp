@@ -0,0 +1,247 @@
+// checks the single bit error correction of the packet assembler against every single, double and a set of triple bit flips
+
+#include <Arduino.h>
+
+#include "RinnaiPacketAssembler.hpp"
+
+thread_local uint32_t hostCpuFrequencyMhz = 240;
+
+const int PACKETS = 16;
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+			failures++; \
+		} \
+	} while (0)
+
+// test packets are built by hand, the checksum helper of the protocol decoder is private
+static void makePacket(byte *data, int i)
+{
+	byte checksum = 0;
+	data[0] = 0x07 | ((i & 0x7) << 4);
+	data[1] = i & 1 ? 0x40 : 0x00;
+	data[2] = (i % 15) | (i & 2 ? 0x10 : 0x00);
+	data[3] = (i * 7) & 0x7f;
+	data[4] = 0x20;
+	for (int b = 0; b < RinnaiPacketAssembler::BYTES_IN_PACKET - 1; b++)
+	{
+		data[b] |= __builtin_parity(data[b]) ? 0x00 : 0x80;
+		checksum ^= data[b];
+	}
+	data[RinnaiPacketAssembler::BYTES_IN_PACKET - 1] = checksum;
+}
+
+static void flipBit(byte *data, int bit)
+{
+	data[bit / 8] ^= 1 << (bit % 8);
+}
+
+static BitQueueItem symbol(BIT value)
+{
+	return {(unsigned int)value};
+}
+
+// pushes the bits LSB first like the pulse classifier hands them over, returns the packets that became ready
+static int pushBits(RinnaiPacketAssembler &assembler, const byte *data, PacketQueueItem &ready)
+{
+	int packets = 0;
+	for (int b = 0; b < RinnaiPacketAssembler::BITS_IN_PACKET; b++)
+	{
+		if (assembler.push(symbol((data[b / 8] >> (b % 8)) & 1 ? SYM1 : SYM0)) == PACKET_READY)
+		{
+			ready = assembler.getPacket();
+			packets++;
+		}
+	}
+	return packets;
+}
+
+// decodes one frame after a PRE, returns the packets that became ready and the last of them
+static int decodeFrame(RinnaiPacketAssembler &assembler, const byte *data, PacketQueueItem &ready)
+{
+	assembler.push(symbol(PRE));
+	return pushBits(assembler, data, ready);
+}
+
+static void testSingleBitFlips()
+{
+	RinnaiPacketAssembler assembler;
+	byte sent[RinnaiPacketAssembler::BYTES_IN_PACKET];
+	byte received[RinnaiPacketAssembler::BYTES_IN_PACKET];
+	int frames = 0;
+	for (int i = 0; i < PACKETS; i++)
+	{
+		makePacket(sent, i);
+		for (int bit = 0; bit < RinnaiPacketAssembler::BITS_IN_PACKET; bit++)
+		{
+			memcpy(received, sent, sizeof(sent));
+			flipBit(received, bit);
+			PacketQueueItem ready = {};
+			CHECK(decodeFrame(assembler, received, ready) == 1);
+			CHECK(RinnaiPacketAssembler::isValid(ready));
+			CHECK(memcmp(ready.data, sent, sizeof(sent)) == 0);
+			frames++;
+		}
+	}
+	CHECK((int)assembler.getCorrectedPacketCounter() == frames);
+	CHECK(assembler.getUncorrectablePacketCounter() == 0);
+	printf("single bit flips: %d frames, corrected %u, uncorrectable %u\n", frames, assembler.getCorrectedPacketCounter(), assembler.getUncorrectablePacketCounter());
+
+	// without correction the same frames are reported as they came
+	assembler.clearCounters();
+	assembler.setErrorCorrection(false);
+	makePacket(sent, 0);
+	flipBit(sent, 3);
+	PacketQueueItem ready = {};
+	CHECK(decodeFrame(assembler, sent, ready) == 1);
+	CHECK(!RinnaiPacketAssembler::isValid(ready));
+	CHECK(memcmp(ready.data, sent, sizeof(sent)) == 0);
+	CHECK(assembler.getCorrectedPacketCounter() == 0);
+	CHECK(assembler.getUncorrectablePacketCounter() == 1);
+}
+
+// two flips in one byte keep its parity, two flips in different bytes break the parity of both
+// neither may be "corrected" into a packet that was not sent
+static void testDoubleBitFlips()
+{
+	RinnaiPacketAssembler assembler;
+	byte sent[RinnaiPacketAssembler::BYTES_IN_PACKET];
+	byte received[RinnaiPacketAssembler::BYTES_IN_PACKET];
+	int sameByte = 0;
+	int differentBytes = 0;
+	for (int i = 0; i < PACKETS; i++)
+	{
+		makePacket(sent, i);
+		for (int first = 0; first < RinnaiPacketAssembler::BITS_IN_PACKET; first++)
+		{
+			for (int second = first + 1; second < RinnaiPacketAssembler::BITS_IN_PACKET; second++)
+			{
+				memcpy(received, sent, sizeof(sent));
+				flipBit(received, first);
+				flipBit(received, second);
+				PacketQueueItem ready = {};
+				CHECK(decodeFrame(assembler, received, ready) == 1);
+				CHECK(!RinnaiPacketAssembler::isValid(ready));
+				CHECK(memcmp(ready.data, received, sizeof(received)) == 0); // reported as it came, not half repaired
+				if (first / 8 == second / 8)
+				{
+					sameByte++;
+				}
+				else
+				{
+					differentBytes++;
+				}
+			}
+		}
+	}
+	CHECK(assembler.getCorrectedPacketCounter() == 0);
+	CHECK((int)assembler.getUncorrectablePacketCounter() == sameByte + differentBytes);
+	printf("double bit flips: %d in one byte, %d in different bytes, corrected %u, uncorrectable %u\n", sameByte, differentBytes, assembler.getCorrectedPacketCounter(),
+		   assembler.getUncorrectablePacketCounter());
+}
+
+// one flip in one byte and two in another leave a single byte with bad parity, only the checksum column shows more than one bit
+// three flips in three different columns may not be "corrected", with two in the same column they cannot be told from a single flip
+static void testThreeBitFlips()
+{
+	RinnaiPacketAssembler assembler;
+	byte sent[RinnaiPacketAssembler::BYTES_IN_PACKET];
+	byte received[RinnaiPacketAssembler::BYTES_IN_PACKET];
+	int frames = 0;
+	makePacket(sent, 3);
+	for (int single = 0; single < RinnaiPacketAssembler::BITS_IN_PACKET; single++)
+	{
+		for (int first = 0; first < RinnaiPacketAssembler::BITS_IN_PACKET; first++)
+		{
+			for (int second = first + 1; second < RinnaiPacketAssembler::BITS_IN_PACKET; second++)
+			{
+				bool distinctColumns = single % 8 != first % 8 && single % 8 != second % 8;
+				if (first / 8 != second / 8 || first / 8 == single / 8 || !distinctColumns)
+				{
+					continue;
+				}
+				memcpy(received, sent, sizeof(sent));
+				flipBit(received, single);
+				flipBit(received, first);
+				flipBit(received, second);
+				PacketQueueItem ready = {};
+				CHECK(decodeFrame(assembler, received, ready) == 1);
+				CHECK(!RinnaiPacketAssembler::isValid(ready));
+				frames++;
+			}
+		}
+	}
+	CHECK(assembler.getCorrectedPacketCounter() == 0);
+	CHECK((int)assembler.getUncorrectablePacketCounter() == frames);
+	printf("triple bit flips in three columns: %d frames, corrected %u, uncorrectable %u\n", frames, assembler.getCorrectedPacketCounter(), assembler.getUncorrectablePacketCounter());
+}
+
+// only the window that starts right at the anchor is aligned, a slipped window is never corrected
+static void testOnlyAlignedWindowIsCorrected()
+{
+	byte sent[RinnaiPacketAssembler::BYTES_IN_PACKET];
+	makePacket(sent, 5);
+	// an extra symbol after the PRE, the misaligned window is reported as it came and the packet is recovered one symbol later
+	{
+		RinnaiPacketAssembler assembler;
+		PacketQueueItem ready = {};
+		assembler.push(symbol(PRE));
+		assembler.push(symbol(SYM1));
+		CHECK(pushBits(assembler, sent, ready) == 2);
+		CHECK(RinnaiPacketAssembler::isValid(ready));
+		CHECK(ready.recovered);
+		CHECK(memcmp(ready.data, sent, sizeof(sent)) == 0);
+		CHECK(assembler.getRecoveredPacketCounter() == 1);
+		CHECK(assembler.getCorrectedPacketCounter() == 0);
+	}
+	// the same with a flipped bit, correction was tried only on the misaligned window and the slipped one is dropped
+	for (int bit = 0; bit < RinnaiPacketAssembler::BITS_IN_PACKET; bit++)
+	{
+		byte received[RinnaiPacketAssembler::BYTES_IN_PACKET];
+		memcpy(received, sent, sizeof(sent));
+		flipBit(received, bit);
+		RinnaiPacketAssembler assembler;
+		PacketQueueItem ready = {};
+		assembler.push(symbol(PRE));
+		assembler.push(symbol(SYM1));
+		CHECK(pushBits(assembler, received, ready) == 1);
+		CHECK(!RinnaiPacketAssembler::isValid(ready));
+		CHECK(assembler.getCorrectedPacketCounter() == 0);
+		CHECK(assembler.getUncorrectablePacketCounter() == 1);
+	}
+	// a damaged PRE anchors on the gap, that window is aligned too and gets corrected
+	{
+		RinnaiPacketAssembler assembler;
+		PacketQueueItem ready = {};
+		byte received[RinnaiPacketAssembler::BYTES_IN_PACKET];
+		memcpy(received, sent, sizeof(sent));
+		flipBit(received, 20);
+		assembler.push({BIT_GAP_MASK | ERROR});
+		CHECK(pushBits(assembler, received, ready) == 1);
+		CHECK(RinnaiPacketAssembler::isValid(ready));
+		CHECK(ready.recovered);
+		CHECK(memcmp(ready.data, sent, sizeof(sent)) == 0);
+		CHECK(assembler.getCorrectedPacketCounter() == 1);
+	}
+}
+
+int main()
+{
+	testSingleBitFlips();
+	testDoubleBitFlips();
+	testThreeBitFlips();
+	testOnlyAlignedWindowIsCorrected();
+	if (failures != 0)
+	{
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("packet assembler ok\n");
+	return 0;
+}
@@ -0,0 +1,707 @@
+// offline analyzer for long captures of the Rinnai bus, see "Offline analysis" in README.md
+// decodes with the same classes as the firmware and spreads the work over all cores
+
+#include <Arduino.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "RinnaiPacketAssembler.hpp"
+#include "RinnaiProtocolDecoder.hpp"
+#include "RinnaiPulseClassifier.hpp"
+
+thread_local uint32_t hostCpuFrequencyMhz = 240;
+
+// capture log, written by RinnaiCaptureLog
+const char CAPTURE_MAGIC[] = "RCAP";
+const byte CAPTURE_VERSION = 1;
+const byte FLAG_REMOTE = 0x01;
+const byte FLAG_VALID_PRE = 0x02;
+const byte FLAG_VALID_PARITY = 0x04;
+const byte FLAG_VALID_CHECKSUM = 0x08;
+const byte FLAG_RECOVERED = 0x10;
+const byte FLAG_SESSION = 0x40;
+const byte FLAG_REPEAT = 0x80;
+// edge stream, sent by RinnaiEdgeServer
+const char EDGE_MAGIC[] = "REDG";
+const byte EDGE_VERSION = 1;
+const size_t EDGE_HEADER_BYTES = 9; // magic, version, cpu Hz
+const size_t EDGE_CHUNK_WORDS = 4 << 20; // edges per job
+const size_t EDGE_WARMUP_WORDS = 4096; // edges decoded around a chunk so the packets on its borders are complete
+const int GLITCH_FILTER_MIN_PULSE_US = 50; // the firmware default
+
+// buses, indexed like the remote flag of the capture log
+const int BUS_TX = 0; // local control panel side
+const int BUS_RX = 1; // heater side
+const int BUS_COUNT = 2;
+const char *BUS_NAMES[BUS_COUNT] = {"tx", "rx"};
+const int SOURCE_COUNT = 4;
+const char *SOURCE_NAMES[SOURCE_COUNT] = {"invalid", "unknown", "heater", "control"};
+
+enum InputType
+{
+	EDGE_STREAM,
+	CAPTURE_LOG,
+};
+
+struct Input
+{
+	const char *path;
+	const byte *data;
+	size_t size;
+	InputType type;
+	uint32_t cpuHz;
+};
+
+struct Job
+{
+	int input;
+	size_t begin; // edge stream chunk, in edges
+	size_t end;
+	int64_t startCycle; // unwrapped cycle counter at the begin of the chunk
+};
+
+struct Frame
+{
+	uint32_t session; // capture log session, times of different sessions are not related
+	int64_t timeUs; // since boot for capture logs, since the stream started for edge streams
+	byte bus;
+	byte flags; // capture log flags
+	byte data[RINNAI_BYTES_IN_PACKET];
+	uint32_t repeats; // a run of repeats of the previous packet of the bus, not a packet of its own
+};
+
+struct BusCounters
+{
+	uint64_t packets;
+	uint64_t valid;
+	uint64_t badParity;
+	uint64_t badChecksum;
+	uint64_t noPre;
+	uint64_t recovered;
+	// edge streams only
+	uint64_t edges;
+	uint64_t frameSlots;
+	uint64_t glitches;
+	uint64_t edgeErrors; // edges out of order
+	uint64_t symbolErrors;
+	uint64_t corrected;
+	uint64_t uncorrectable;
+};
+
+struct PeriodStats
+{
+	uint64_t count;
+	double sumUs;
+	int64_t minUs;
+	int64_t maxUs;
+
+	void add(int64_t us, uint64_t n)
+	{
+		if (count == 0 || us < minUs)
+		{
+			minUs = us;
+		}
+		if (count == 0 || us > maxUs)
+		{
+			maxUs = us;
+		}
+		count += n;
+		sumUs += (double)us * n;
+	}
+	void merge(const PeriodStats &other)
+	{
+		if (other.count == 0)
+		{
+			return;
+		}
+		minUs = count == 0 ? other.minUs : std::min(minUs, other.minUs);
+		maxUs = count == 0 ? other.maxUs : std::max(maxUs, other.maxUs);
+		count += other.count;
+		sumUs += other.sumUs;
+	}
+};
+
+struct JobResult
+{
+	std::vector<Frame> frames;
+	std::unordered_map<uint64_t, uint64_t> census; // bus and bytes of a valid packet to count
+	BusCounters counters[BUS_COUNT] = {};
+	PeriodStats periods[BUS_COUNT][SOURCE_COUNT] = {};
+	// last valid packet of every source, to measure periods
+	uint32_t lastSession[BUS_COUNT][SOURCE_COUNT] = {};
+	int64_t lastTimeUs[BUS_COUNT][SOURCE_COUNT] = {};
+	bool hasLast[BUS_COUNT][SOURCE_COUNT] = {};
+	// first valid packet of every source, its period starts in the previous chunk
+	uint32_t firstSession[BUS_COUNT][SOURCE_COUNT] = {};
+	int64_t firstTimeUs[BUS_COUNT][SOURCE_COUNT] = {};
+	uint64_t firstPackets[BUS_COUNT][SOURCE_COUNT] = {};
+	bool hasFirst[BUS_COUNT][SOURCE_COUNT] = {};
+	std::string error;
+};
+
+bool keepFrames = false;
+
+static uint64_t censusKey(const Frame &frame)
+{
+	uint64_t key = frame.bus;
+	for (int i = 0; i < RINNAI_BYTES_IN_PACKET; i++)
+	{
+		key = (key << 8) | frame.data[i];
+	}
+	return key;
+}
+
+static void addFrame(JobResult &result, const Frame &frame)
+{
+	BusCounters &counters = result.counters[frame.bus];
+	uint64_t packets = frame.repeats ? frame.repeats : 1;
+	bool valid = (frame.flags & FLAG_VALID_PARITY) && (frame.flags & FLAG_VALID_CHECKSUM);
+	counters.packets += packets;
+	counters.valid += valid ? packets : 0;
+	counters.badParity += frame.flags & FLAG_VALID_PARITY ? 0 : packets;
+	counters.badChecksum += frame.flags & FLAG_VALID_CHECKSUM ? 0 : packets;
+	counters.noPre += frame.flags & FLAG_VALID_PRE ? 0 : packets;
+	counters.recovered += frame.flags & FLAG_RECOVERED ? packets : 0;
+	if (keepFrames)
+	{
+		result.frames.push_back(frame);
+	}
+	if (!valid)
+	{
+		return;
+	}
+	result.census[censusKey(frame)] += packets;
+	// a run only has the time of its last repeat, spread it evenly
+	int source = RinnaiProtocolDecoder::getPacketSource(frame.data, RINNAI_BYTES_IN_PACKET);
+	if (result.hasLast[frame.bus][source] && result.lastSession[frame.bus][source] == frame.session)
+	{
+		result.periods[frame.bus][source].add((frame.timeUs - result.lastTimeUs[frame.bus][source]) / (int64_t)packets, packets);
+	}
+	else if (!result.hasFirst[frame.bus][source])
+	{
+		result.hasFirst[frame.bus][source] = true;
+		result.firstSession[frame.bus][source] = frame.session;
+		result.firstTimeUs[frame.bus][source] = frame.timeUs;
+		result.firstPackets[frame.bus][source] = packets;
+	}
+	result.hasLast[frame.bus][source] = true;
+	result.lastSession[frame.bus][source] = frame.session;
+	result.lastTimeUs[frame.bus][source] = frame.timeUs;
+}
+
+static bool readVarint(const Input &input, size_t &pos, uint32_t &value)
+{
+	value = 0;
+	for (int shift = 0; pos < input.size && shift < 32; shift += 7)
+	{
+		byte b = input.data[pos++];
+		value |= (uint32_t)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static void decodeCaptureLog(const Input &input, JobResult &result)
+{
+	size_t pos = 0;
+	uint32_t session = 0;
+	uint32_t lastMillis = 0;
+	Frame last[BUS_COUNT];
+	bool hasLast[BUS_COUNT] = {};
+	bool truncated = false;
+	while (pos < input.size)
+	{
+		byte flags = input.data[pos++];
+		if (flags == FLAG_SESSION)
+		{
+			uint32_t startMillis;
+			if (pos + 5 > input.size || memcmp(input.data + pos, CAPTURE_MAGIC, 4) != 0 || input.data[pos + 4] != CAPTURE_VERSION)
+			{
+				result.error = "bad session header";
+				return;
+			}
+			pos += 5;
+			if (!readVarint(input, pos, startMillis))
+			{
+				truncated = true;
+				break;
+			}
+			session++;
+			lastMillis = startMillis;
+			hasLast[BUS_TX] = hasLast[BUS_RX] = false;
+			continue;
+		}
+		if (session == 0)
+		{
+			result.error = "no session header";
+			return;
+		}
+		uint32_t zigzag;
+		if (!readVarint(input, pos, zigzag))
+		{
+			truncated = true;
+			break;
+		}
+		lastMillis += (int32_t)((zigzag >> 1) ^ -(zigzag & 1));
+		int bus = flags & FLAG_REMOTE ? BUS_RX : BUS_TX;
+		if (flags & FLAG_REPEAT)
+		{
+			uint32_t count;
+			if (!readVarint(input, pos, count))
+			{
+				truncated = true;
+				break;
+			}
+			if (!hasLast[bus])
+			{
+				result.error = "repeat without a packet";
+				return;
+			}
+			Frame frame = last[bus];
+			frame.timeUs = (int64_t)lastMillis * 1000;
+			frame.repeats = count;
+			addFrame(result, frame);
+			continue;
+		}
+		if (pos + RINNAI_BYTES_IN_PACKET > input.size)
+		{
+			truncated = true;
+			break;
+		}
+		Frame &frame = last[bus];
+		frame.session = session;
+		frame.timeUs = (int64_t)lastMillis * 1000;
+		frame.bus = bus;
+		frame.flags = flags;
+		memcpy(frame.data, input.data + pos, RINNAI_BYTES_IN_PACKET);
+		frame.repeats = 0;
+		pos += RINNAI_BYTES_IN_PACKET;
+		hasLast[bus] = true;
+		addFrame(result, frame);
+	}
+	if (truncated)
+	{
+		result.error = "truncated record at the end"; // a power cut while writing, the rest was decoded
+	}
+}
+
+static uint32_t edgeAt(const Input &input, size_t index)
+{
+	uint32_t word;
+	memcpy(&word, input.data + EDGE_HEADER_BYTES + index * sizeof(word), sizeof(word)); // little endian, like the device
+	return word;
+}
+
+static size_t edgeCount(const Input &input)
+{
+	return (input.size - EDGE_HEADER_BYTES) / sizeof(uint32_t);
+}
+
+// the cycle counter wraps every few seconds, follow it from a known position
+// edges of the two buses are not strictly in order so a small step back is not a wrap
+static int64_t unwrapCycle(int64_t &position, uint32_t word)
+{
+	uint32_t cycle = word & ~(PULSE_LEVEL_MASK | EDGE_TAP_ID_MASK);
+	int64_t value = position + (int32_t)(cycle - (uint32_t)position);
+	if (value > position)
+	{
+		position = value;
+	}
+	return value;
+}
+
+// how far the cycle counter moved from the begin of a chunk to the begin of the next one
+static int64_t measureChunk(const Input &input, const Job &job)
+{
+	int64_t position = edgeAt(input, job.begin) & ~(PULSE_LEVEL_MASK | EDGE_TAP_ID_MASK);
+	int64_t start = position;
+	for (size_t i = job.begin + 1; i <= job.end && i < edgeCount(input); i++)
+	{
+		unwrapCycle(position, edgeAt(input, i));
+	}
+	return position - start;
+}
+
+struct BusDecoder
+{
+	RinnaiPulseClassifier classifier;
+	RinnaiPacketAssembler assembler;
+	size_t anchorIndex = 0;
+	int64_t anchorCycle = 0;
+};
+
+static void takeCounters(BusDecoder &decoder, BusCounters &counters, int sign)
+{
+	counters.frameSlots += sign * (int64_t)decoder.classifier.getFrameSlotCounter();
+	counters.glitches += sign * (int64_t)decoder.classifier.getGlitchCounter();
+	counters.edgeErrors += sign * (int64_t)decoder.classifier.getErrorCounter();
+	counters.symbolErrors += sign * (int64_t)decoder.assembler.getErrorCounter();
+	counters.corrected += sign * (int64_t)decoder.assembler.getCorrectedPacketCounter();
+	counters.uncorrectable += sign * (int64_t)decoder.assembler.getUncorrectablePacketCounter();
+}
+
+static void decodeEdges(const Input &input, const Job &job, JobResult &result)
+{
+	hostCpuFrequencyMhz = input.cpuHz / 1000000;
+	BusDecoder decoders[BUS_COUNT];
+	for (BusDecoder &decoder : decoders)
+	{
+		decoder.classifier.setGlitchFilter(GLITCH_FILTER_MIN_PULSE_US);
+	}
+	int64_t streamStartCycle = edgeAt(input, 0) & ~(PULSE_LEVEL_MASK | EDGE_TAP_ID_MASK);
+	int64_t position = job.startCycle;
+	size_t from = job.begin > EDGE_WARMUP_WORDS ? job.begin - EDGE_WARMUP_WORDS : 0;
+	size_t to = std::min(edgeCount(input), job.end + EDGE_WARMUP_WORDS);
+	for (size_t i = from; i < to; i++)
+	{
+		// only count what happened inside the chunk
+		if (i == job.begin || i == job.end)
+		{
+			for (int bus = 0; bus < BUS_COUNT; bus++)
+			{
+				takeCounters(decoders[bus], result.counters[bus], i == job.begin ? -1 : 1);
+			}
+		}
+		uint32_t word = edgeAt(input, i);
+		int bus = word & EDGE_TAP_ID_MASK ? BUS_TX : BUS_RX;
+		if (i >= job.begin)
+		{
+			unwrapCycle(position, word);
+			result.counters[bus].edges += i < job.end;
+		}
+		BusDecoder &decoder = decoders[bus];
+		PulseQueueItem pulse = {word & ~EDGE_TAP_ID_MASK};
+		BitQueueItem bit;
+		if (!decoder.classifier.push(pulse, bit))
+		{
+			continue;
+		}
+		PacketAssemblerEvent event = decoder.assembler.push(bit);
+		PacketQueueItem &packet = decoder.assembler.getPacket();
+		if (event == PACKET_ANCHORED)
+		{
+			decoder.anchorIndex = i;
+			decoder.anchorCycle = position + (int32_t)(packet.startCycle - (uint32_t)position);
+			continue;
+		}
+		if (event != PACKET_READY || decoder.anchorIndex < job.begin || decoder.anchorIndex >= job.end)
+		{
+			continue;
+		}
+		Frame frame;
+		frame.session = 0;
+		frame.timeUs = (decoder.anchorCycle - streamStartCycle) / hostCpuFrequencyMhz;
+		frame.bus = bus;
+		frame.flags = (bus == BUS_RX ? FLAG_REMOTE : 0) |
+					  (packet.validPre ? FLAG_VALID_PRE : 0) |
+					  (packet.validParity ? FLAG_VALID_PARITY : 0) |
+					  (packet.validChecksum ? FLAG_VALID_CHECKSUM : 0) |
+					  (packet.recovered ? FLAG_RECOVERED : 0);
+		memcpy(frame.data, packet.data, RINNAI_BYTES_IN_PACKET);
+		frame.repeats = 0;
+		addFrame(result, frame);
+	}
+	if (to == job.end) // the last chunk
+	{
+		for (int bus = 0; bus < BUS_COUNT; bus++)
+		{
+			takeCounters(decoders[bus], result.counters[bus], 1);
+		}
+	}
+}
+
+static bool openInput(const char *path, Input &input)
+{
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		fprintf(stderr, "%s: can not open\n", path);
+		return false;
+	}
+	input.path = path;
+	input.size = st.st_size;
+	input.data = input.size ? (const byte *)mmap(NULL, input.size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+	close(fd);
+	if (input.size && input.data == MAP_FAILED)
+	{
+		fprintf(stderr, "%s: can not map\n", path);
+		return false;
+	}
+	madvise((void *)input.data, input.size, MADV_SEQUENTIAL);
+	if (input.size >= EDGE_HEADER_BYTES && memcmp(input.data, EDGE_MAGIC, 4) == 0 && input.data[4] == EDGE_VERSION)
+	{
+		input.type = EDGE_STREAM;
+		memcpy(&input.cpuHz, input.data + 5, sizeof(input.cpuHz));
+		return input.cpuHz >= 1000000 && edgeCount(input) > 0;
+	}
+	if (input.size >= 5 && input.data[0] == FLAG_SESSION && memcmp(input.data + 1, CAPTURE_MAGIC, 4) == 0)
+	{
+		input.type = CAPTURE_LOG;
+		return true;
+	}
+	fprintf(stderr, "%s: not a capture log or an edge stream\n", path);
+	return false;
+}
+
+// run a function over all jobs on all threads
+template <typename F>
+static void runJobs(size_t jobCount, int threadCount, F function)
+{
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadCount; t++)
+	{
+		threads.emplace_back([&]() {
+			for (size_t j = next++; j < jobCount; j = next++)
+			{
+				function(j);
+			}
+		});
+	}
+	for (std::thread &thread : threads)
+	{
+		thread.join();
+	}
+}
+
+static void writeFrames(FILE *out, const std::vector<Input> &inputs, const std::vector<Job> &jobs, const std::vector<JobResult> &results)
+{
+	fprintf(out, "file,session,time_us,bus,source,bytes,pre,parity,checksum,recovered,repeats,decoded\n");
+	for (size_t j = 0; j < jobs.size(); j++)
+	{
+		for (const Frame &frame : results[j].frames)
+		{
+			RinnaiPacketSource source = RinnaiProtocolDecoder::getPacketSource(frame.data, RINNAI_BYTES_IN_PACKET);
+			char decoded[64] = "";
+			if (source == HEATER)
+			{
+				RinnaiHeaterPacket packet;
+				RinnaiProtocolDecoder::decodeHeaterPacket(frame.data, packet);
+				snprintf(decoded, sizeof(decoded), "on=%d inUse=%d temp=%d activeId=%d", packet.on, packet.inUse, packet.temperatureCelsius, packet.activeId);
+			}
+			else if (source == CONTROL)
+			{
+				RinnaiControlPacket packet;
+				RinnaiProtocolDecoder::decodeControlPacket(frame.data, packet);
+				snprintf(decoded, sizeof(decoded), "id=%d onOff=%d priority=%d up=%d down=%d", packet.myId, packet.onOffPressed, packet.priorityPressed, packet.temperatureUpPressed, packet.temperatureDownPressed);
+			}
+			fprintf(out, "%s,%u,%lld,%s,%s,%02x:%02x:%02x:%02x:%02x:%02x,%d,%d,%d,%d,%u,%s\n",
+					inputs[jobs[j].input].path, frame.session, (long long)frame.timeUs, BUS_NAMES[frame.bus], SOURCE_NAMES[source],
+					frame.data[0], frame.data[1], frame.data[2], frame.data[3], frame.data[4], frame.data[5],
+					(bool)(frame.flags & FLAG_VALID_PRE), (bool)(frame.flags & FLAG_VALID_PARITY), (bool)(frame.flags & FLAG_VALID_CHECKSUM), (bool)(frame.flags & FLAG_RECOVERED),
+					frame.repeats, decoded);
+		}
+	}
+}
+
+static void printReport(const JobResult &total, size_t edgeStreams)
+{
+	for (int bus = BUS_COUNT - 1; bus >= 0; bus--)
+	{
+		const BusCounters &c = total.counters[bus];
+		printf("\nbus %s\n", BUS_NAMES[bus]);
+		printf("  packets %llu, valid %llu, bad parity %llu, bad checksum %llu, no preamble %llu, recovered %llu\n",
+			   (unsigned long long)c.packets, (unsigned long long)c.valid, (unsigned long long)c.badParity, (unsigned long long)c.badChecksum, (unsigned long long)c.noPre, (unsigned long long)c.recovered);
+		if (edgeStreams > 0)
+		{
+			uint64_t loss = c.frameSlots > c.valid ? (c.frameSlots - c.valid) * 1000 / c.frameSlots : 0;
+			printf("  edges %llu, frame slots %llu, loss %llu/1000, corrected %llu, uncorrectable %llu, glitches %llu, edge errors %llu, symbol errors %llu\n",
+				   (unsigned long long)c.edges, (unsigned long long)c.frameSlots, (unsigned long long)loss, (unsigned long long)c.corrected, (unsigned long long)c.uncorrectable,
+				   (unsigned long long)c.glitches, (unsigned long long)c.edgeErrors, (unsigned long long)c.symbolErrors);
+		}
+		for (int source = 0; source < SOURCE_COUNT; source++)
+		{
+			const PeriodStats &p = total.periods[bus][source];
+			if (p.count > 0)
+			{
+				printf("  %s period: %llu, mean %.1f ms, min %.1f ms, max %.1f ms\n", SOURCE_NAMES[source], (unsigned long long)p.count, p.sumUs / p.count / 1000, p.minUs / 1000.0, p.maxUs / 1000.0);
+			}
+		}
+	}
+	// most common first
+	std::vector<std::pair<uint64_t, uint64_t>> census(total.census.begin(), total.census.end());
+	std::sort(census.begin(), census.end(), [](const std::pair<uint64_t, uint64_t> &a, const std::pair<uint64_t, uint64_t> &b) {
+		return a.second != b.second ? a.second > b.second : a.first < b.first;
+	});
+	printf("\ncensus, %zu variants\n", census.size());
+	for (const std::pair<uint64_t, uint64_t> &entry : census)
+	{
+		byte data[RINNAI_BYTES_IN_PACKET];
+		for (int i = 0; i < RINNAI_BYTES_IN_PACKET; i++)
+		{
+			data[i] = entry.first >> ((RINNAI_BYTES_IN_PACKET - 1 - i) * 8);
+		}
+		int bus = entry.first >> (RINNAI_BYTES_IN_PACKET * 8);
+		printf("  %s %-7s %s %llu\n", BUS_NAMES[bus], SOURCE_NAMES[RinnaiProtocolDecoder::getPacketSource(data, RINNAI_BYTES_IN_PACKET)], RinnaiProtocolDecoder::renderPacket(data).c_str(), (unsigned long long)entry.second);
+	}
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: rinnai-analyzer [-j threads] [-f frames.csv] capture...\n");
+	fprintf(stderr, "captures are capture logs downloaded from /capture or edge streams saved from port 2323\n");
+}
+
+int main(int argc, char **argv)
+{
+	int threadCount = std::max(1u, std::thread::hardware_concurrency());
+	const char *framesPath = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "j:f:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'j':
+			threadCount = std::max(1, atoi(optarg));
+			break;
+		case 'f':
+			framesPath = optarg;
+			break;
+		default:
+			usage();
+			return 2;
+		}
+	}
+	if (optind == argc)
+	{
+		usage();
+		return 2;
+	}
+	keepFrames = framesPath != NULL;
+	auto startTime = std::chrono::steady_clock::now();
+
+	// split the work, edge streams are cut into chunks
+	std::vector<Input> inputs;
+	std::vector<Job> jobs;
+	size_t edgeStreams = 0;
+	uint64_t totalBytes = 0;
+	for (int i = optind; i < argc; i++)
+	{
+		Input input;
+		if (!openInput(argv[i], input))
+		{
+			continue;
+		}
+		inputs.push_back(input);
+		totalBytes += input.size;
+		if (input.type == CAPTURE_LOG)
+		{
+			jobs.push_back({(int)inputs.size() - 1, 0, 0, 0});
+			continue;
+		}
+		edgeStreams++;
+		for (size_t begin = 0; begin < edgeCount(input); begin += EDGE_CHUNK_WORDS)
+		{
+			jobs.push_back({(int)inputs.size() - 1, begin, std::min(edgeCount(input), begin + EDGE_CHUNK_WORDS), 0});
+		}
+	}
+	// find where the cycle counter stands at the begin of every chunk, measured in parallel and summed up in order
+	std::vector<int64_t> chunkCycles(jobs.size());
+	runJobs(jobs.size(), threadCount, [&](size_t j) {
+		if (inputs[jobs[j].input].type == EDGE_STREAM)
+		{
+			chunkCycles[j] = measureChunk(inputs[jobs[j].input], jobs[j]);
+		}
+	});
+	for (size_t j = 0; j < jobs.size(); j++)
+	{
+		const Input &input = inputs[jobs[j].input];
+		if (input.type != EDGE_STREAM)
+		{
+			continue;
+		}
+		jobs[j].startCycle = jobs[j].begin == 0 ? edgeAt(input, 0) & ~(PULSE_LEVEL_MASK | EDGE_TAP_ID_MASK) : jobs[j - 1].startCycle + chunkCycles[j - 1];
+	}
+	// decode
+	std::vector<JobResult> results(jobs.size());
+	runJobs(jobs.size(), threadCount, [&](size_t j) {
+		const Input &input = inputs[jobs[j].input];
+		if (input.type == EDGE_STREAM)
+		{
+			decodeEdges(input, jobs[j], results[j]);
+		}
+		else
+		{
+			decodeCaptureLog(input, results[j]);
+		}
+	});
+	// merge
+	JobResult total;
+	uint64_t frames = 0;
+	for (size_t j = 0; j < jobs.size(); j++)
+	{
+		const JobResult &result = results[j];
+		if (!result.error.empty())
+		{
+			fprintf(stderr, "%s: %s\n", inputs[jobs[j].input].path, result.error.c_str());
+		}
+		for (int bus = 0; bus < BUS_COUNT; bus++)
+		{
+			const BusCounters &from = result.counters[bus];
+			BusCounters &to = total.counters[bus];
+			const uint64_t *src = (const uint64_t *)&from;
+			uint64_t *dst = (uint64_t *)&to;
+			for (size_t k = 0; k < sizeof(BusCounters) / sizeof(uint64_t); k++)
+			{
+				dst[k] += src[k];
+			}
+			frames += from.packets;
+			for (int source = 0; source < SOURCE_COUNT; source++)
+			{
+				total.periods[bus][source].merge(result.periods[bus][source]);
+				// the period across the border of two chunks of the same edge stream
+				if (j > 0 && jobs[j].input != jobs[j - 1].input)
+				{
+					total.hasLast[bus][source] = false;
+				}
+				if (result.hasFirst[bus][source] && total.hasLast[bus][source] && total.lastSession[bus][source] == result.firstSession[bus][source])
+				{
+					uint64_t packets = result.firstPackets[bus][source];
+					total.periods[bus][source].add((result.firstTimeUs[bus][source] - total.lastTimeUs[bus][source]) / (int64_t)packets, packets);
+				}
+				if (result.hasLast[bus][source])
+				{
+					total.hasLast[bus][source] = true;
+					total.lastSession[bus][source] = result.lastSession[bus][source];
+					total.lastTimeUs[bus][source] = result.lastTimeUs[bus][source];
+				}
+			}
+		}
+		for (const std::pair<const uint64_t, uint64_t> &entry : result.census)
+		{
+			total.census[entry.first] += entry.second;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	printf("%zu files, %zu edge streams, %llu bytes, %zu jobs on %d threads\n", inputs.size(), edgeStreams, (unsigned long long)totalBytes, jobs.size(), threadCount);
+	printf("%llu packets in %.3f s, %.0f packets/s\n", (unsigned long long)frames, seconds, seconds > 0 ? frames / seconds : 0);
+	printReport(total, edgeStreams);
+
+	if (framesPath != NULL)
+	{
+		FILE *out = fopen(framesPath, "w");
+		if (out == NULL)
+		{
+			fprintf(stderr, "%s: can not write\n", framesPath);
+			return 1;
+		}
+		writeFrames(out, inputs, jobs, results);
+		fclose(out);
+	}
+	return 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+// the part of the Arduino API used by the firmware decoding classes, to build them on a Linux host
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+class String : public std::string
+{
+public:
+	String() {}
+	String(const char *s) : std::string(s) {}
+	String(const std::string &s) : std::string(s) {}
+};
+
+// the cycle counter rate of the device that made the capture, each analysis thread sets its own
+extern thread_local uint32_t hostCpuFrequencyMhz;
+
+// the hardware random number generator, a fixed seed per thread so noise sweeps repeat exactly
+inline thread_local std::mt19937 hostRandom(1);
+inline uint32_t esp_random()
+{
+	return hostRandom();
+}
+
+// ms since the process started
+inline unsigned long millis()
+{
+	static const auto start = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// same as the ESP32 core
+#define clockCyclesPerMicrosecond() ((long int)hostCpuFrequencyMhz)
+#define clockCyclesToMicroseconds(a) ((a) / clockCyclesPerMicrosecond())
+#define microsecondsToClockCycles(a) ((a) * clockCyclesPerMicrosecond())
+
+// the host tools are single threaded per decoder, so the critical sections have nothing to guard
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux))
+#define IRAM_ATTR
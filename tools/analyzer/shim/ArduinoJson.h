@@ -0,0 +1,247 @@
+#pragma once
+// a stand-in for the part of ArduinoJson 6 that the state message uses, to build its rendering on a Linux host
+// like the library it allocates the capacity of a document once, keeps const char * keys and values by pointer,
+// copies String values into the document and finds a key again by a linear scan
+// it only writes flat objects, and its timing is the share of the firmware code, not that of the library itself
+
+#include <Arduino.h>
+
+#include <cstdlib>
+
+#define JSON_OBJECT_SIZE(n) ((n) * 16)
+#define JSON_ARRAY_SIZE(n) ((n) * 16)
+
+class DynamicJsonDocument;
+
+class JsonVariant
+{
+public:
+	JsonVariant(DynamicJsonDocument &doc, const char *key) : doc(doc), key(key) {}
+	JsonVariant &operator=(bool value);
+	JsonVariant &operator=(int value)
+	{
+		return setSigned(value);
+	}
+	JsonVariant &operator=(long value)
+	{
+		return setSigned(value);
+	}
+	JsonVariant &operator=(unsigned int value)
+	{
+		return setUnsigned(value);
+	}
+	JsonVariant &operator=(unsigned long value)
+	{
+		return setUnsigned(value);
+	}
+	JsonVariant &operator=(const char *value);
+	JsonVariant &operator=(const String &value);
+
+private:
+	JsonVariant &setSigned(long value);
+	JsonVariant &setUnsigned(unsigned long value);
+
+	DynamicJsonDocument &doc;
+	const char *key;
+};
+
+class DynamicJsonDocument
+{
+public:
+	enum Type
+	{
+		BOOL,
+		SIGNED,
+		UNSIGNED,
+		STRING,
+	};
+	struct Member
+	{
+		const char *key;
+		Type type;
+		union
+		{
+			bool b;
+			long i;
+			unsigned long u;
+			const char *s;
+		};
+	};
+
+	explicit DynamicJsonDocument(size_t capacity) : capacity(capacity), pool((char *)malloc(capacity)), stringsStart(capacity) {}
+	DynamicJsonDocument(const DynamicJsonDocument &) = delete;
+	DynamicJsonDocument &operator=(const DynamicJsonDocument &) = delete;
+	~DynamicJsonDocument()
+	{
+		free(pool);
+	}
+
+	JsonVariant operator[](const char *key)
+	{
+		return JsonVariant(*this, key);
+	}
+	bool overflowed() const
+	{
+		return overflow;
+	}
+	void clear()
+	{
+		size = 0;
+		stringsStart = capacity;
+		overflow = false;
+	}
+
+	// the slot of the key, a new one at the end if it is not there yet, nullptr when the document is full
+	Member *slot(const char *key)
+	{
+		Member *members = (Member *)pool;
+		for (size_t i = 0; i < size; i++)
+		{
+			if (strcmp(members[i].key, key) == 0)
+			{
+				return &members[i];
+			}
+		}
+		if ((size + 1) * JSON_OBJECT_SIZE(1) > stringsStart)
+		{
+			overflow = true;
+			return nullptr;
+		}
+		members[size].key = key;
+		return &members[size++];
+	}
+	// strings are copied to the end of the pool, members grow from the start
+	const char *copyString(const String &value)
+	{
+		if (stringsStart < size * JSON_OBJECT_SIZE(1) + value.length() + 1)
+		{
+			overflow = true;
+			return nullptr;
+		}
+		stringsStart -= value.length() + 1;
+		memcpy(pool + stringsStart, value.c_str(), value.length() + 1);
+		return pool + stringsStart;
+	}
+	size_t getSize() const
+	{
+		return size;
+	}
+	const Member &getMember(size_t i) const
+	{
+		return ((const Member *)pool)[i];
+	}
+
+private:
+	size_t capacity;
+	char *pool;
+	size_t size = 0;
+	size_t stringsStart;
+	bool overflow = false;
+};
+
+inline JsonVariant &JsonVariant::operator=(bool value)
+{
+	DynamicJsonDocument::Member *member = doc.slot(key);
+	if (member != nullptr)
+	{
+		member->type = DynamicJsonDocument::BOOL;
+		member->b = value;
+	}
+	return *this;
+}
+
+inline JsonVariant &JsonVariant::setSigned(long value)
+{
+	DynamicJsonDocument::Member *member = doc.slot(key);
+	if (member != nullptr)
+	{
+		member->type = DynamicJsonDocument::SIGNED;
+		member->i = value;
+	}
+	return *this;
+}
+
+inline JsonVariant &JsonVariant::setUnsigned(unsigned long value)
+{
+	DynamicJsonDocument::Member *member = doc.slot(key);
+	if (member != nullptr)
+	{
+		member->type = DynamicJsonDocument::UNSIGNED;
+		member->u = value;
+	}
+	return *this;
+}
+
+inline JsonVariant &JsonVariant::operator=(const char *value)
+{
+	DynamicJsonDocument::Member *member = doc.slot(key);
+	if (member != nullptr)
+	{
+		member->type = DynamicJsonDocument::STRING;
+		member->s = value;
+	}
+	return *this;
+}
+
+inline JsonVariant &JsonVariant::operator=(const String &value)
+{
+	DynamicJsonDocument::Member *member = doc.slot(key);
+	const char *copy = member != nullptr ? doc.copyString(value) : nullptr;
+	if (copy != nullptr)
+	{
+		member->type = DynamicJsonDocument::STRING;
+		member->s = copy;
+	}
+	return *this;
+}
+
+// appends to the string through a small buffer, like the library's writer for String
+inline size_t serializeJson(const DynamicJsonDocument &doc, String &output)
+{
+	char buffer[32];
+	size_t used = 0;
+	size_t written = 0;
+	auto write = [&](const char *s) {
+		for (; *s != '\0'; s++)
+		{
+			if (used == sizeof(buffer))
+			{
+				output.append(buffer, used);
+				used = 0;
+			}
+			buffer[used++] = *s;
+			written++;
+		}
+	};
+	write("{");
+	for (size_t i = 0; i < doc.getSize(); i++)
+	{
+		const DynamicJsonDocument::Member &member = doc.getMember(i);
+		char number[24];
+		write(i == 0 ? "\"" : ",\"");
+		write(member.key);
+		write("\":");
+		switch (member.type)
+		{
+		case DynamicJsonDocument::BOOL:
+			write(member.b ? "true" : "false");
+			break;
+		case DynamicJsonDocument::SIGNED:
+			snprintf(number, sizeof(number), "%ld", member.i);
+			write(number);
+			break;
+		case DynamicJsonDocument::UNSIGNED:
+			snprintf(number, sizeof(number), "%lu", member.u);
+			write(number);
+			break;
+		case DynamicJsonDocument::STRING:
+			write("\"");
+			write(member.s);
+			write("\"");
+			break;
+		}
+	}
+	write("}");
+	output.append(buffer, used);
+	return written;
+}
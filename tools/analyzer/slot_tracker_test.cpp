@@ -0,0 +1,183 @@
+// checks the slot tracker and the slot scheduling of panel emulation against simulated bus timing
+
+#include <Arduino.h>
+
+#include <vector>
+
+#include "RinnaiSlotTracker.hpp"
+
+thread_local uint32_t hostCpuFrequencyMhz = 240;
+
+const unsigned int PERIOD_US = 200000; // a cycle that was observed on real heaters
+const unsigned int TOLERANCE_US = 500; // the tracker's hit window
+const int JITTER_US[] = {0, 80, -60, 100, -100, 30, -20, 90, -80, 10}; // panel start errors, repeating
+const int JITTER_COUNT = sizeof(JITTER_US) / sizeof(JITTER_US[0]);
+const unsigned int START_CYCLE = 0xffffffff - microsecondsToClockCycles(3 * PERIOD_US); // wraps after a few packets
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+			failures++; \
+		} \
+	} while (0)
+
+static int distanceMicros(unsigned int a, unsigned int b)
+{
+	int delta = (int)(a - b);
+	return clockCyclesToMicroseconds(delta < 0 ? -delta : delta);
+}
+
+// the ideal start of panel slot n
+static unsigned int slotCycle(unsigned int origin, int n)
+{
+	return origin + n * microsecondsToClockCycles(PERIOD_US);
+}
+
+// the start of panel packet n as the decoder time stamps it
+static unsigned int panelCycle(unsigned int origin, int n)
+{
+	return slotCycle(origin, n) + microsecondsToClockCycles(JITTER_US[n % JITTER_COUNT]);
+}
+
+static void testNoEstimate()
+{
+	RinnaiSlotTracker tracker;
+	CHECK(!tracker.isLocked());
+	CHECK(!tracker.isSlotStart(START_CYCLE));
+	CHECK(tracker.predictNextStart(START_CYCLE) == START_CYCLE);
+	// emulation keeps its own cycle until it has one to follow
+	unsigned int period = microsecondsToClockCycles(PERIOD_US);
+	CHECK(tracker.scheduleSlot(START_CYCLE, 0, period) == START_CYCLE + period);
+	CHECK(tracker.scheduleSlot(START_CYCLE, START_CYCLE + period / 2, period) == START_CYCLE + period / 2);
+	// a period outside the known range is not used
+	tracker.update(START_CYCLE);
+	tracker.update(START_CYCLE + microsecondsToClockCycles(50000));
+	CHECK(tracker.getPeriodCycles() == 0);
+}
+
+static void testLock()
+{
+	RinnaiSlotTracker tracker;
+	int n = 0;
+	for (; n < 3; n++)
+	{
+		tracker.update(panelCycle(START_CYCLE, n));
+		CHECK(!tracker.isLocked());
+	}
+	for (; n < 10; n++)
+	{
+		tracker.update(panelCycle(START_CYCLE, n));
+	}
+	CHECK(tracker.isLocked());
+	CHECK(distanceMicros(tracker.getPeriodCycles(), microsecondsToClockCycles(PERIOD_US)) < 100);
+	CHECK(tracker.getHitPerMille() == 1000);
+	// the gate opens only around the predicted start, also after the cycle counter wrapped
+	unsigned int next = slotCycle(START_CYCLE, n);
+	CHECK(tracker.isSlotStart(next));
+	CHECK(tracker.isSlotStart(next + microsecondsToClockCycles(TOLERANCE_US / 2)));
+	CHECK(!tracker.isSlotStart(next + microsecondsToClockCycles(2 * TOLERANCE_US)));
+	CHECK(!tracker.isSlotStart(next - microsecondsToClockCycles(PERIOD_US / 2)));
+	CHECK(distanceMicros(tracker.predictNextStart(next - microsecondsToClockCycles(PERIOD_US / 2)), next) < (int)TOLERANCE_US);
+	// a packet that failed to decode does not break the lock
+	tracker.update(panelCycle(START_CYCLE, n + 1));
+	CHECK(tracker.isLocked());
+	// a packet far from the prediction means the panel restarted
+	tracker.update(slotCycle(START_CYCLE, n + 2) + microsecondsToClockCycles(PERIOD_US / 3));
+	CHECK(!tracker.isLocked());
+	CHECK(tracker.getPeriodCycles() == 0);
+}
+
+// runs the slot scheduling of RinnaiSignalDecoder::emulateSlot, returns the start of every emulated packet
+// the panel sends its packets until panelSlots, the emulation wakes up a few ms after each of our packets
+static std::vector<unsigned int> emulate(RinnaiSlotTracker &tracker, int panelSlots, int slots)
+{
+	unsigned int period = microsecondsToClockCycles(PERIOD_US);
+	unsigned int nextSlot = 0;
+	unsigned int now = panelCycle(START_CYCLE, 0) + microsecondsToClockCycles(10000);
+	int panel = 0;
+	std::vector<unsigned int> starts;
+	while ((int)starts.size() < slots)
+	{
+		unsigned int trackedPeriod = tracker.getPeriodCycles();
+		unsigned int emulationPeriod = trackedPeriod != 0 ? trackedPeriod : period;
+		nextSlot = tracker.scheduleSlot(now, nextSlot, emulationPeriod);
+		int waitCycles = (int)(nextSlot - now);
+		CHECK(waitCycles > 0 && waitCycles <= (int)emulationPeriod);
+		// the panel packets that the decoder saw while we waited
+		while (panel < panelSlots && (int)(panelCycle(START_CYCLE, panel) - nextSlot) <= (int)microsecondsToClockCycles(TOLERANCE_US))
+		{
+			tracker.update(panelCycle(START_CYCLE, panel));
+			panel++;
+		}
+		starts.push_back(nextSlot);
+		nextSlot += emulationPeriod;
+		now = starts.back() + microsecondsToClockCycles(40000); // the packet takes about 35ms on the bus
+	}
+	return starts;
+}
+
+static void testEmulationFollowsPanel()
+{
+	RinnaiSlotTracker tracker;
+	const int panelSlots = 30;
+	std::vector<unsigned int> starts = emulate(tracker, panelSlots, 60);
+	CHECK(tracker.isLocked());
+	for (size_t i = 1; i < starts.size(); i++)
+	{
+		// one packet per slot, the phase may only jump when the lock is gained
+		int spacing = distanceMicros(starts[i], starts[i - 1]);
+		CHECK(spacing > (int)PERIOD_US / 2 && spacing < (int)PERIOD_US + 1000);
+		if (i > 10)
+		{
+			CHECK(spacing > (int)PERIOD_US - 1000);
+		}
+	}
+	// once locked every emulated packet lands on a panel slot, also after the panel went quiet
+	int locked = 0;
+	for (unsigned int start : starts)
+	{
+		int slot = (int)((start - START_CYCLE + microsecondsToClockCycles(PERIOD_US) / 2) / microsecondsToClockCycles(PERIOD_US));
+		int error = distanceMicros(start, slotCycle(START_CYCLE, slot));
+		if (slot > 10)
+		{
+			CHECK(error < 2 * (int)TOLERANCE_US);
+			locked++;
+		}
+	}
+	CHECK(locked > panelSlots);
+}
+
+static void testEmulationWithoutPanel()
+{
+	RinnaiSlotTracker tracker;
+	std::vector<unsigned int> starts = emulate(tracker, 0, 10);
+	CHECK(!tracker.isLocked());
+	for (size_t i = 1; i < starts.size(); i++)
+	{
+		CHECK(starts[i] - starts[i - 1] == microsecondsToClockCycles(PERIOD_US));
+	}
+	// a slot that was missed starts a new cycle instead of sending late
+	unsigned int period = microsecondsToClockCycles(PERIOD_US);
+	unsigned int late = starts.back() + microsecondsToClockCycles(1000);
+	CHECK(tracker.scheduleSlot(late, starts.back(), period) == late + period);
+}
+
+int main()
+{
+	testNoEstimate();
+	testLock();
+	testEmulationFollowsPanel();
+	testEmulationWithoutPanel();
+	if (failures != 0)
+	{
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("slot tracker ok\n");
+	return 0;
+}
@@ -0,0 +1,135 @@
+// checks that the batch symbol classifier matches the firmware one and measures how fast every kernel is
+
+#include <Arduino.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "RinnaiPulseClassifier.hpp"
+#include "symbol_kernel.hpp"
+
+thread_local uint32_t hostCpuFrequencyMhz = 240;
+
+const size_t BENCH_PULSES = 16 << 20;
+const int BENCH_ROUNDS = 10;
+const SymbolKernel KERNELS[] = {KERNEL_SCALAR, KERNEL_SSE2, KERNEL_AVX2};
+
+// every pair around the window edges, random pairs and odd lengths for the tails
+static bool checkKernel(SymbolKernel kernel, std::mt19937 &random)
+{
+	std::vector<uint32_t> low;
+	std::vector<uint32_t> high;
+	const uint32_t edges[] = {0, 1, 2, 0x7fffffff, 0x80000000, 0x80000001, 0xfffffffe, 0xffffffff};
+	for (uint32_t l = 0; l < 1300; l++)
+	{
+		for (uint32_t h = 0; h < 1300; h++)
+		{
+			low.push_back(l);
+			high.push_back(h);
+		}
+	}
+	for (uint32_t a : edges)
+	{
+		for (uint32_t b = 0; b < 1300; b++)
+		{
+			low.push_back(a);
+			high.push_back(b);
+			low.push_back(b);
+			high.push_back(a);
+		}
+	}
+	for (int i = 0; i < 1000000; i++)
+	{
+		low.push_back(random());
+		high.push_back(random());
+	}
+	std::vector<byte> symbols(low.size() + 1);
+	for (size_t count : {low.size(), low.size() - 1, (size_t)31, (size_t)17, (size_t)3})
+	{
+		symbols[count] = 0xaa; // must not be written
+		classifySymbols(kernel, low.data(), high.data(), symbols.data(), count);
+		for (size_t i = 0; i < count; i++)
+		{
+			BIT expected = RinnaiPulseClassifier::classifySymbol(low[i], high[i]);
+			if (symbols[i] != expected)
+			{
+				printf("%s: mismatch at low %u high %u, %d instead of %d\n", getSymbolKernelName(kernel), low[i], high[i], symbols[i], expected);
+				return false;
+			}
+		}
+		if (symbols[count] != 0xaa)
+		{
+			printf("%s: wrote past the end\n", getSymbolKernelName(kernel));
+			return false;
+		}
+	}
+	return true;
+}
+
+// realistic pulses with some noise, as the classifier sees them when replaying captures
+static void makePulses(std::vector<uint32_t> &low, std::vector<uint32_t> &high, std::mt19937 &random)
+{
+	std::normal_distribution<double> jitter(0, 30);
+	for (size_t i = 0; i < BENCH_PULSES; i++)
+	{
+		int symbol = i % 49 == 0 ? (int)PRE : (int)(random() & 1);
+		double l = symbol == PRE ? 200000 : symbol == SYM1 ? 150 : 450;
+		double h = symbol == PRE ? 850 : symbol == SYM1 ? 450 : 150;
+		low.push_back(std::max(0.0, l + jitter(random)));
+		high.push_back(std::max(0.0, h + jitter(random)));
+	}
+}
+
+int main()
+{
+	std::mt19937 random(1);
+	bool ok = true;
+	for (SymbolKernel kernel : KERNELS)
+	{
+		if (kernel > getBestSymbolKernel())
+		{
+			printf("%s: not supported by this CPU\n", getSymbolKernelName(kernel));
+			continue;
+		}
+		bool match = checkKernel(kernel, random);
+		printf("%s: %s\n", getSymbolKernelName(kernel), match ? "matches the firmware" : "DOES NOT MATCH the firmware");
+		ok &= match;
+	}
+
+	std::vector<uint32_t> low;
+	std::vector<uint32_t> high;
+	makePulses(low, high, random);
+	std::vector<byte> symbols(low.size());
+	double bytes = low.size() * (2 * sizeof(uint32_t) + sizeof(byte));
+	// the firmware function, one call per pulse
+	auto start = std::chrono::steady_clock::now();
+	unsigned int sum = 0;
+	for (int round = 0; round < BENCH_ROUNDS; round++)
+	{
+		for (size_t i = 0; i < low.size(); i++)
+		{
+			symbols[i] = RinnaiPulseClassifier::classifySymbol(low[i], high[i]);
+		}
+		sum += symbols[round];
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("\n%-8s %6.2f ns/pulse %7.2f GB/s\n", "firmware", seconds * 1e9 / BENCH_ROUNDS / low.size(), bytes * BENCH_ROUNDS / seconds / 1e9);
+	for (SymbolKernel kernel : KERNELS)
+	{
+		if (kernel > getBestSymbolKernel())
+		{
+			continue;
+		}
+		start = std::chrono::steady_clock::now();
+		for (int round = 0; round < BENCH_ROUNDS; round++)
+		{
+			classifySymbols(kernel, low.data(), high.data(), symbols.data(), low.size());
+			sum += symbols[round];
+		}
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("%-8s %6.2f ns/pulse %7.2f GB/s\n", getSymbolKernelName(kernel), seconds * 1e9 / BENCH_ROUNDS / low.size(), bytes * BENCH_ROUNDS / seconds / 1e9);
+	}
+	printf("(%u)\n", sum); // keep the results alive
+	return ok ? 0 : 1;
+}
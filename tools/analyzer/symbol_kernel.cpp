@@ -0,0 +1,172 @@
+#include "symbol_kernel.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SYMBOL_KERNEL_X86
+#endif
+
+// a value is in (min, max) if value - min - 1 < max - min - 1 as unsigned
+// SSE/AVX2 only compare signed, flipping the sign bit of both sides turns that into an unsigned compare
+const uint32_t SIGN_BIT = 0x80000000;
+
+// same branches as the firmware
+static void classifyScalar(const uint32_t *lowUs, const uint32_t *highUs, byte *symbols, size_t count, const SymbolWindows &w)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		uint32_t low = lowUs[i];
+		uint32_t high = highUs[i];
+		if (high > w.preMinUs)
+		{
+			symbols[i] = PRE;
+		}
+		else if (low > w.shortMinUs && low < w.shortMaxUs && high > w.longMinUs && high < w.longMaxUs)
+		{
+			symbols[i] = SYM1;
+		}
+		else if (low > w.longMinUs && low < w.longMaxUs && high > w.shortMinUs && high < w.shortMaxUs)
+		{
+			symbols[i] = SYM0;
+		}
+		else
+		{
+			symbols[i] = ERROR;
+		}
+	}
+}
+
+#ifdef SYMBOL_KERNEL_X86
+// the offset compare only holds for windows with max > min, inverted windows are only possible in sweeps
+// and are sent to the scalar kernel
+static bool isVectorFriendly(const SymbolWindows &w)
+{
+	return w.shortMaxUs > w.shortMinUs && w.longMaxUs > w.longMinUs;
+}
+
+static void classifySSE2(const uint32_t *lowUs, const uint32_t *highUs, byte *symbols, size_t count, const SymbolWindows &w)
+{
+	const __m128i sign = _mm_set1_epi32(SIGN_BIT);
+	const __m128i pre = _mm_set1_epi32(w.preMinUs ^ SIGN_BIT);
+	const __m128i shortBase = _mm_set1_epi32(w.shortMinUs + 1);
+	const __m128i shortSpan = _mm_set1_epi32((w.shortMaxUs - w.shortMinUs - 1) ^ SIGN_BIT);
+	const __m128i longBase = _mm_set1_epi32(w.longMinUs + 1);
+	const __m128i longSpan = _mm_set1_epi32((w.longMaxUs - w.longMinUs - 1) ^ SIGN_BIT);
+	const __m128i codeError = _mm_set1_epi32(ERROR);
+	const __m128i codePre = _mm_set1_epi32(PRE);
+	const __m128i codeOne = _mm_set1_epi32(SYM1);
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i codes[4];
+		for (int j = 0; j < 4; j++)
+		{
+			__m128i low = _mm_loadu_si128((const __m128i *)(lowUs + i + j * 4));
+			__m128i high = _mm_loadu_si128((const __m128i *)(highUs + i + j * 4));
+			__m128i isPre = _mm_cmpgt_epi32(_mm_xor_si128(high, sign), pre);
+			__m128i lowShort = _mm_cmplt_epi32(_mm_xor_si128(_mm_sub_epi32(low, shortBase), sign), shortSpan);
+			__m128i lowLong = _mm_cmplt_epi32(_mm_xor_si128(_mm_sub_epi32(low, longBase), sign), longSpan);
+			__m128i highShort = _mm_cmplt_epi32(_mm_xor_si128(_mm_sub_epi32(high, shortBase), sign), shortSpan);
+			__m128i highLong = _mm_cmplt_epi32(_mm_xor_si128(_mm_sub_epi32(high, longBase), sign), longSpan);
+			__m128i isOne = _mm_and_si128(lowShort, highLong);
+			__m128i isZero = _mm_and_si128(lowLong, highShort);
+			// ERROR, then 1 or 0 (SYM0 is 0 so clearing is enough), PRE wins over all
+			__m128i code = _mm_andnot_si128(_mm_or_si128(isOne, isZero), codeError);
+			code = _mm_or_si128(code, _mm_and_si128(isOne, codeOne));
+			codes[j] = _mm_or_si128(_mm_andnot_si128(isPre, code), _mm_and_si128(isPre, codePre));
+		}
+		__m128i packed = _mm_packus_epi16(_mm_packs_epi32(codes[0], codes[1]), _mm_packs_epi32(codes[2], codes[3]));
+		_mm_storeu_si128((__m128i *)(symbols + i), packed);
+	}
+	classifyScalar(lowUs + i, highUs + i, symbols + i, count - i, w);
+}
+
+__attribute__((target("avx2"))) static void classifyAVX2(const uint32_t *lowUs, const uint32_t *highUs, byte *symbols, size_t count, const SymbolWindows &w)
+{
+	const __m256i sign = _mm256_set1_epi32(SIGN_BIT);
+	const __m256i pre = _mm256_set1_epi32(w.preMinUs ^ SIGN_BIT);
+	const __m256i shortBase = _mm256_set1_epi32(w.shortMinUs + 1);
+	const __m256i shortSpan = _mm256_set1_epi32((w.shortMaxUs - w.shortMinUs - 1) ^ SIGN_BIT);
+	const __m256i longBase = _mm256_set1_epi32(w.longMinUs + 1);
+	const __m256i longSpan = _mm256_set1_epi32((w.longMaxUs - w.longMinUs - 1) ^ SIGN_BIT);
+	const __m256i codeError = _mm256_set1_epi32(ERROR);
+	const __m256i codePre = _mm256_set1_epi32(PRE);
+	const __m256i codeOne = _mm256_set1_epi32(SYM1);
+	const __m256i lanes = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7); // undo the per 128 bit lane packing
+	size_t i = 0;
+	for (; i + 32 <= count; i += 32)
+	{
+		__m256i codes[4];
+		for (int j = 0; j < 4; j++)
+		{
+			__m256i low = _mm256_loadu_si256((const __m256i *)(lowUs + i + j * 8));
+			__m256i high = _mm256_loadu_si256((const __m256i *)(highUs + i + j * 8));
+			__m256i isPre = _mm256_cmpgt_epi32(_mm256_xor_si256(high, sign), pre);
+			__m256i lowShort = _mm256_cmpgt_epi32(shortSpan, _mm256_xor_si256(_mm256_sub_epi32(low, shortBase), sign));
+			__m256i lowLong = _mm256_cmpgt_epi32(longSpan, _mm256_xor_si256(_mm256_sub_epi32(low, longBase), sign));
+			__m256i highShort = _mm256_cmpgt_epi32(shortSpan, _mm256_xor_si256(_mm256_sub_epi32(high, shortBase), sign));
+			__m256i highLong = _mm256_cmpgt_epi32(longSpan, _mm256_xor_si256(_mm256_sub_epi32(high, longBase), sign));
+			__m256i isOne = _mm256_and_si256(lowShort, highLong);
+			__m256i isZero = _mm256_and_si256(lowLong, highShort);
+			__m256i code = _mm256_andnot_si256(_mm256_or_si256(isOne, isZero), codeError);
+			code = _mm256_or_si256(code, _mm256_and_si256(isOne, codeOne));
+			codes[j] = _mm256_blendv_epi8(code, codePre, isPre);
+		}
+		// packs work within 128 bit lanes, the 4 byte groups come out as codes 0-3 of every vector and then codes 4-7
+		__m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(codes[0], codes[1]), _mm256_packs_epi32(codes[2], codes[3]));
+		_mm256_storeu_si256((__m256i *)(symbols + i), _mm256_permutevar8x32_epi32(packed, lanes));
+	}
+	classifyScalar(lowUs + i, highUs + i, symbols + i, count - i, w);
+}
+#endif
+
+SymbolKernel getBestSymbolKernel()
+{
+#ifdef SYMBOL_KERNEL_X86
+	static const SymbolKernel best = __builtin_cpu_supports("avx2") ? KERNEL_AVX2 : KERNEL_SSE2;
+	return best;
+#else
+	return KERNEL_SCALAR;
+#endif
+}
+
+const char *getSymbolKernelName(SymbolKernel kernel)
+{
+	switch (kernel)
+	{
+	case KERNEL_SSE2:
+		return "sse2";
+	case KERNEL_AVX2:
+		return "avx2";
+	default:
+		return "scalar";
+	}
+}
+
+bool classifySymbols(SymbolKernel kernel, const uint32_t *lowUs, const uint32_t *highUs, byte *symbols, size_t count, const SymbolWindows &windows)
+{
+	if (kernel > getBestSymbolKernel())
+	{
+		return false;
+	}
+#ifdef SYMBOL_KERNEL_X86
+	if (kernel != KERNEL_SCALAR && isVectorFriendly(windows))
+	{
+		if (kernel == KERNEL_AVX2)
+		{
+			classifyAVX2(lowUs, highUs, symbols, count, windows);
+		}
+		else
+		{
+			classifySSE2(lowUs, highUs, symbols, count, windows);
+		}
+		return true;
+	}
+#endif
+	classifyScalar(lowUs, highUs, symbols, count, windows);
+	return true;
+}
+
+void classifySymbols(const uint32_t *lowUs, const uint32_t *highUs, byte *symbols, size_t count, const SymbolWindows &windows)
+{
+	classifySymbols(getBestSymbolKernel(), lowUs, highUs, symbols, count, windows);
+}
@@ -0,0 +1,40 @@
+#pragma once
+// batch version of RinnaiPulseClassifier::classifySymbol for the host tools
+// classifies arrays of low/high periods with SIMD compares, to replay captures and sweep the timing windows fast
+
+#include <Arduino.h>
+
+#include "RinnaiPulseClassifier.hpp"
+
+// the ranges are exclusive, like in the firmware
+struct SymbolWindows
+{
+	uint32_t preMinUs; // a high period longer than this is a PRE
+	uint32_t shortMinUs;
+	uint32_t shortMaxUs;
+	uint32_t longMinUs;
+	uint32_t longMaxUs;
+};
+
+// the windows the firmware uses
+const SymbolWindows FIRMWARE_SYMBOL_WINDOWS = {
+	RinnaiPulseClassifier::SYMBOL_DURATION_US,
+	RinnaiPulseClassifier::SYMBOL_SHORT_PERIOD_RATIO_MIN,
+	RinnaiPulseClassifier::SYMBOL_SHORT_PERIOD_RATIO_MAX,
+	RinnaiPulseClassifier::SYMBOL_LONG_PERIOD_RATIO_MIN,
+	RinnaiPulseClassifier::SYMBOL_LONG_PERIOD_RATIO_MAX,
+};
+
+enum SymbolKernel
+{
+	KERNEL_SCALAR,
+	KERNEL_SSE2,
+	KERNEL_AVX2,
+};
+
+// writes a BIT value for every low/high pair, the best kernel the CPU supports is picked once
+void classifySymbols(const uint32_t *lowUs, const uint32_t *highUs, byte *symbols, size_t count, const SymbolWindows &windows = FIRMWARE_SYMBOL_WINDOWS);
+// a specific kernel, for testing and benchmarks. returns false if the CPU does not support it
+bool classifySymbols(SymbolKernel kernel, const uint32_t *lowUs, const uint32_t *highUs, byte *symbols, size_t count, const SymbolWindows &windows = FIRMWARE_SYMBOL_WINDOWS);
+SymbolKernel getBestSymbolKernel();
+const char *getSymbolKernelName(SymbolKernel kernel);
@@ -0,0 +1,153 @@
+// checks that the usage aggregator splits heater packets at the minute and hour boundaries and keeps closed periods until they are taken
+
+#include <Arduino.h>
+
+#include "RinnaiUsageAggregator.hpp"
+
+thread_local uint32_t hostCpuFrequencyMhz = 240;
+
+const unsigned long STEP_MS = 700; // does not divide a minute, so a packet spans each boundary
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+			failures++; \
+		} \
+	} while (0)
+
+static RinnaiHeaterPacket heater(bool on, bool inUse)
+{
+	RinnaiHeaterPacket packet = {};
+	packet.on = on;
+	packet.inUse = inUse;
+	packet.temperatureCelsius = 40;
+	return packet;
+}
+
+static void testMinuteBoundary()
+{
+	RinnaiUsageAggregator usage;
+	RinnaiUsageAggregator::Aggregate aggregate;
+	unsigned long t = 0;
+	for (; t < RinnaiUsageAggregator::MINUTE_MS; t += STEP_MS)
+	{
+		usage.update(heater(true, true), t);
+		CHECK(!usage.takeMinute(aggregate));
+	}
+	// the packet at 59500ms lasts until 60200ms, 500ms of it belong to the first minute
+	usage.update(heater(true, false), t);
+	CHECK(usage.takeMinute(aggregate));
+	CHECK(aggregate.startMillis == 0);
+	CHECK(aggregate.coveredMillis == RinnaiUsageAggregator::MINUTE_MS);
+	CHECK(aggregate.onMillis == RinnaiUsageAggregator::MINUTE_MS);
+	CHECK(aggregate.inUseMillis == RinnaiUsageAggregator::MINUTE_MS);
+	CHECK(aggregate.setpointMillis == 40 * RinnaiUsageAggregator::MINUTE_MS);
+	CHECK(!usage.takeMinute(aggregate)); // returned once
+	// the rest of it is in the second minute, as is an ignition in the next packet
+	usage.update(heater(true, true), t + STEP_MS);
+	t += 2 * STEP_MS;
+	for (; t < 2 * RinnaiUsageAggregator::MINUTE_MS; t += STEP_MS)
+	{
+		usage.update(heater(true, true), t);
+	}
+	usage.update(heater(true, true), t);
+	CHECK(usage.takeMinute(aggregate));
+	CHECK(aggregate.startMillis == RinnaiUsageAggregator::MINUTE_MS);
+	CHECK(aggregate.coveredMillis == RinnaiUsageAggregator::MINUTE_MS);
+	CHECK(aggregate.onMillis == RinnaiUsageAggregator::MINUTE_MS);
+	CHECK(aggregate.inUseMillis == RinnaiUsageAggregator::MINUTE_MS - STEP_MS); // off from 60200ms until the packet at 60900ms
+	CHECK(aggregate.ignitions == 1);
+}
+
+// the minutes of an hour add up to the hour, none of the time is lost or counted twice at the boundaries
+static void testHourAddsUp()
+{
+	RinnaiUsageAggregator usage;
+	RinnaiUsageAggregator::Aggregate aggregate;
+	unsigned long minutesCovered = 0;
+	unsigned long minutesInUse = 0;
+	int minutes = 0;
+	unsigned long t = 0;
+	for (; t <= RinnaiUsageAggregator::HOUR_MS; t += STEP_MS)
+	{
+		usage.update(heater(true, (t / 10000) % 2 == 0), t);
+		if (usage.takeMinute(aggregate))
+		{
+			CHECK(aggregate.coveredMillis == RinnaiUsageAggregator::MINUTE_MS);
+			minutesCovered += aggregate.coveredMillis;
+			minutesInUse += aggregate.inUseMillis;
+			minutes++;
+		}
+	}
+	usage.update(heater(true, false), t);
+	if (usage.takeMinute(aggregate))
+	{
+		minutesCovered += aggregate.coveredMillis;
+		minutesInUse += aggregate.inUseMillis;
+		minutes++;
+	}
+	CHECK(minutes == 60);
+	CHECK(usage.takeHour(aggregate));
+	CHECK(aggregate.coveredMillis == RinnaiUsageAggregator::HOUR_MS);
+	CHECK(aggregate.coveredMillis == minutesCovered);
+	CHECK(aggregate.inUseMillis == minutesInUse);
+}
+
+static void testBusGone()
+{
+	RinnaiUsageAggregator usage;
+	RinnaiUsageAggregator::Aggregate aggregate;
+	usage.update(heater(true, true), 0);
+	usage.update(heater(true, true), 500);
+	// a gap of more than a second is not extrapolated, a gap of more than a period starts a new one at the next packet
+	usage.update(heater(true, true), 30000);
+	usage.update(heater(true, true), 30500);
+	const unsigned long restart = 3 * RinnaiUsageAggregator::MINUTE_MS + 12345;
+	usage.update(heater(true, true), restart);
+	CHECK(usage.takeMinute(aggregate));
+	CHECK(aggregate.startMillis == 0);
+	CHECK(aggregate.coveredMillis == 1000);
+	// the last packet before a gap is not extrapolated to the end of the minute either
+	usage.update(heater(true, true), restart + 500);
+	usage.update(heater(true, true), restart + RinnaiUsageAggregator::MINUTE_MS + 2000);
+	CHECK(usage.takeMinute(aggregate));
+	CHECK(aggregate.startMillis == restart);
+	CHECK(aggregate.coveredMillis == 500);
+	CHECK(aggregate.inUseMillis == 500);
+}
+
+// a closed hour that is not taken, e.g. while MQTT is down, waits until the next hour closes
+static void testClosedHourIsKept()
+{
+	RinnaiUsageAggregator usage;
+	RinnaiUsageAggregator::Aggregate aggregate;
+	unsigned long t = 0;
+	for (; t <= RinnaiUsageAggregator::HOUR_MS + RinnaiUsageAggregator::HOUR_MS / 2; t += STEP_MS)
+	{
+		usage.update(heater(true, false), t);
+	}
+	CHECK(usage.takeHour(aggregate));
+	CHECK(aggregate.startMillis == 0);
+	CHECK(aggregate.coveredMillis == RinnaiUsageAggregator::HOUR_MS);
+	CHECK(!usage.takeHour(aggregate));
+}
+
+int main()
+{
+	testMinuteBoundary();
+	testHourAddsUp();
+	testBusGone();
+	testClosedHourIsKept();
+	if (failures != 0)
+	{
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("usage aggregator ok\n");
+	return 0;
+}
@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+"""Convert a raw edge stream of the device (see "Raw edge streaming" in README.md) to a VCD file.
+
+The input is either a live stream (host:port) or a file saved from it, e.g. with "nc rinnai-wifi 2323 > edges.bin".
+The VCD can be opened in PulseView/sigrok or GTKWave.
+
+Usage:
+    edges_to_vcd.py rinnai-wifi:2323 capture.vcd [--seconds 60]
+    edges_to_vcd.py edges.bin capture.vcd
+"""
+import argparse
+import heapq
+import socket
+import struct
+import sys
+import time
+
+MAGIC = b"REDG"
+VERSION = 1
+HEADER = struct.Struct("<4sBI")
+WORD = struct.Struct("<I")
+LEVEL_MASK = 0x1
+ID_MASK = 0x2
+WIRES = (("rx", "!"), ("tx", '"'))  # tap id 0 is the heater side bus, 1 is the local control panel side
+
+
+def open_input(source):
+    host, sep, port = source.rpartition(":")
+    if sep and port.isdigit():
+        sock = socket.create_connection((host, int(port)))
+        return sock.makefile("rb")
+    return open(source, "rb")
+
+
+def read_exact(stream, size):
+    data = stream.read(size)
+    return data if data is not None and len(data) == size else None
+
+
+def convert(stream, out, seconds=None):
+    header = read_exact(stream, HEADER.size)
+    if header is None:
+        sys.exit("no header")
+    magic, version, cpu_hz = HEADER.unpack(header)
+    if magic != MAGIC or version != VERSION:
+        sys.exit("not an edge stream, or an unsupported version")
+    ns_per_cycle = 1e9 / cpu_hz
+
+    out.write("$timescale 1ns $end\n$scope module rinnai $end\n")
+    for name, code in WIRES:
+        out.write("$var wire 1 %s %s $end\n" % (code, name))
+    out.write("$upscope $end\n$enddefinitions $end\n")
+
+    heap = []  # edges of both buses are tapped by separate tasks, sort them before writing
+    window = cpu_hz  # cycles, how late an edge can be tapped compared to the other bus
+    first = None
+    last = None
+    epoch = 0  # wraps of the 32 bit cycle counter
+    levels = [None, None]
+    edges = 0
+
+    def write_until(limit):
+        nonlocal edges
+        while heap and (limit is None or heap[0][0] <= limit):
+            cycle, tap, level = heapq.heappop(heap)
+            if levels[tap] == level:
+                continue
+            levels[tap] = level
+            out.write("#%d\n%d%s\n" % ((cycle - first) * ns_per_cycle, level, WIRES[tap][1]))
+            edges += 1
+
+    start = time.monotonic()
+    try:
+        while seconds is None or time.monotonic() - start < seconds:
+            data = read_exact(stream, WORD.size)
+            if data is None:
+                break
+            (word,) = WORD.unpack(data)
+            cycle = word & ~(LEVEL_MASK | ID_MASK)
+            # a big jump back is a wrap, a big jump forward is a late edge from before the last wrap
+            offset = epoch
+            if last is not None and cycle < last and last - cycle > 0x80000000:
+                epoch += 1
+                offset = epoch
+            elif last is not None and cycle > last and cycle - last > 0x80000000:
+                offset = epoch - 1
+            if offset == epoch:
+                last = cycle
+            cycle += offset << 32
+            if first is None:
+                first = cycle - window  # late edges of the other bus still get a positive time
+            heapq.heappush(heap, (cycle, 1 if word & ID_MASK else 0, word & LEVEL_MASK))
+            write_until(cycle - window)
+    except KeyboardInterrupt:  # stopping a live capture, keep what was received
+        pass
+    write_until(None)
+    return edges
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("source", help="host:port of the device or a saved stream file")
+    parser.add_argument("output", help="VCD file to write")
+    parser.add_argument("--seconds", type=float, help="stop a live capture after this long")
+    args = parser.parse_args()
+    with open_input(args.source) as stream, open(args.output, "w") as out:
+        try:
+            edges = convert(stream, out, args.seconds)
+        except KeyboardInterrupt:
+            edges = None
+    if edges is not None:
+        print("%d edges written" % edges)
+
+
+if __name__ == "__main__":
+    main()
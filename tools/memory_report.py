@@ -0,0 +1,100 @@
+"""Print the RAM of each part of a signal decoder after every firmware build.
+
+Registered in platformio.ini as a post script. The sizes are read from the debug info of firmware.elf
+(build_type = debug) with the gdb of the toolchain, so they are the sizes of this build and board, including
+the FreeRTOS control blocks that only the device headers know. The total is checked against MAX_RAM in
+include/RinnaiSignalDecoder.hpp, which static_asserts the same budget.
+"""
+import os
+import re
+import shutil
+import subprocess
+
+Import("env")  # noqa: F821, provided by PlatformIO
+
+DECODER = "RinnaiSignalDecoder"
+HEADER = os.path.join("include", "RinnaiSignalDecoder.hpp")
+# (label, members) of the static storage of a decoder, see QUEUES_RAM and TASKS_RAM
+PARTS = (
+    ("pulse queue", ("pulseQueueStorage",)),
+    ("bit queue", ("bitQueueStorage",)),
+    ("packet queue", ("packetQueueStorage",)),
+    ("queue control blocks", ("pulseQueueBuffer", "bitQueueBuffer", "packetQueueBuffer")),
+    ("bit task stack", ("bitTaskStack",)),
+    ("packet task stack", ("packetTaskStack",)),
+    ("override task stack", ("overrideTaskStack",)),
+    ("task control blocks", ("bitTaskBuffer", "packetTaskBuffer", "overrideTaskBuffer")),
+)
+GDB_PACKAGES = ("toolchain-xtensa-esp32", "tool-xtensa-esp-elf-gdb")
+GDB_NAMES = ("xtensa-esp32-elf-gdb",)
+
+
+def find_gdb(env):
+    platform = env.PioPlatform()
+    for package in GDB_PACKAGES:
+        directory = platform.get_package_dir(package)
+        for name in GDB_NAMES:
+            path = directory and os.path.join(directory, "bin", name)
+            if path and os.path.isfile(path):
+                return path
+    for name in GDB_NAMES:
+        path = shutil.which(name, path=env["ENV"].get("PATH"))
+        if path:
+            return path
+    return None
+
+
+def read_sizes(gdb, elf):
+    # one printf per size, a member that is not in the debug info only drops its own line
+    names = ["decoder"] + [member for _, members in PARTS for member in members]
+    command = [gdb, "-batch", "-nx", elf]
+    for name in names:
+        expression = DECODER if name == "decoder" else "((%s *)0)->%s" % (DECODER, name)
+        command += ["-ex", 'printf "%s %%u\\n", sizeof(%s)' % (name, expression)]
+    output = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, universal_newlines=True).stdout
+    sizes = {}
+    for line in output.splitlines():
+        match = re.match(r"^(\w+) (\d+)$", line)
+        if match:
+            sizes[match.group(1)] = int(match.group(2))
+    return sizes
+
+
+def read_budget(project_dir):
+    with open(os.path.join(project_dir, HEADER)) as f:
+        match = re.search(r"MAX_RAM = (\d+)( \* 1024)?;", f.read())
+    if match is None:
+        return None
+    return int(match.group(1)) * (1024 if match.group(2) else 1)
+
+
+def report(source, target, env):
+    elf = target[0].get_abspath()
+    gdb = find_gdb(env)
+    if gdb is None:
+        print("Decoder RAM: no gdb in the toolchain, no report")
+        return
+    sizes = read_sizes(gdb, elf)
+    if "decoder" not in sizes:
+        print("Decoder RAM: no debug info for %s in %s, build with build_type = debug" % (DECODER, elf))
+        return
+    print("Decoder RAM, per %s object:" % DECODER)
+    accounted = 0
+    complete = True
+    for label, members in PARTS:
+        if not all(member in sizes for member in members):
+            complete = False
+            print("  %-22s %6s" % (label, "?"))
+            continue
+        size = sum(sizes[member] for member in members)
+        accounted += size
+        print("  %-22s %6d" % (label, size))
+    print("  %-22s %6s" % ("other members", sizes["decoder"] - accounted if complete else "?"))
+    budget = read_budget(env.subst("$PROJECT_DIR"))
+    if budget is None:
+        print("  %-22s %6d" % ("total", sizes["decoder"]))
+    else:
+        print("  %-22s %6d of %d (MAX_RAM)" % ("total", sizes["decoder"], budget))
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", report)  # noqa: F821